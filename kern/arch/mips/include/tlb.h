@@ -53,20 +53,26 @@
  *        is not set. To completely invalidate the TLB, load it with
  *        translations for addresses in one of the unmapped address
  *        ranges - these will never be matched.
+ *
+ *   tlb_setasid: set the address space id in c0_entryhi that the
+ *        processor matches user translations against. Every other
+ *        function here overwrites it with the PID field of ENTRYHI,
+ *        so callers must put it back afterwards.
  */
 
 void tlb_random(uint32_t entryhi, uint32_t entrylo);
 void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
+void tlb_setasid(uint32_t asid);
 
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * Note that the MIPS has support for a 6-bit address space ID, kept
+ * in TLBHI_PID. The VM system tags user translations with one so that
+ * they survive context switches (see addrspace.c). TLBLO_GLOBAL is
+ * left always zero, as are the bits that aren't assigned a meaning.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -78,7 +84,8 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PIDSHIFT 6
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
@@ -95,6 +102,11 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 #define TLBHI_INVALID(entryno) ((0x80000+(entryno))<<12)
 #define TLBLO_INVALID()        (0)
 
+/*
+ * Number of distinct address space ids.
+ */
+#define NUM_ASID 64
+
 /*
  * Number of TLB entries in the processor.
  */
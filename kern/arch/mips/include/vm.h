@@ -122,17 +122,65 @@ paddr_t ram_stealmem(unsigned long npages);
 paddr_t ram_getsize(void);
 paddr_t ram_getfirstfree(void);
 
+/*
+ * Per-cpu cache of free frames kept in front of the UNSW frame
+ * allocator (see unsw.c). It lives in struct cpu and is only touched
+ * by its own cpu, with interrupts off. Frames move between the cache
+ * and the global pool FRAME_CACHE_BATCH at a time.
+ *
+ * frame_cache_init is called from cpu_create for each new cpu.
+ */
+
+#define FRAME_CACHE_SIZE  32
+#define FRAME_CACHE_BATCH 16
+
+struct frame_cache {
+	uint32_t fc_frames[FRAME_CACHE_SIZE];	/* cached frame numbers */
+	unsigned fc_count;			/* entries in fc_frames */
+	unsigned fc_hits;			/* allocations served */
+	unsigned fc_misses;			/* allocations that refilled */
+	unsigned fc_frees;			/* frees absorbed */
+	unsigned fc_drains;			/* batches pushed back */
+	unsigned fc_zphits;			/* zeroed frames from the pool */
+	unsigned fc_zpmisses;			/* zeroed here, pool empty */
+};
+
+void frame_cache_init(struct frame_cache *fc, unsigned cpunum);
+
+/*
+ * Per-cpu TLB state: the address space ids this cpu has handed out
+ * (see addrspace.c) and TLB statistics. It lives in struct cpu and is
+ * only touched by its own cpu with interrupts off.
+ *
+ * cpu_tlb_init is called from cpu_create for each new cpu.
+ */
+
+struct cpu_tlb {
+	uint32_t ct_asid_next;		/* next ASID to hand out */
+	uint32_t ct_asid_gen;		/* bumped each time ASIDs run out */
+	unsigned ct_misses;		/* TLB refill faults */
+	unsigned ct_rollovers;		/* full flushes for ASID reuse */
+	unsigned ct_prefetched;		/* entries loaded by fault-around */
+	unsigned ct_prefetch_wasted;	/* of those, faulted on again */
+	unsigned ct_stlb_hits;		/* misses reloaded from the software TLB */
+	unsigned ct_stlb_misses;	/* misses that went to the page table */
+};
+
+void cpu_tlb_init(struct cpu_tlb *ct, unsigned cpunum);
+
 /*
  * TLB shootdown bits.
  *
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct addrspace;
+struct semaphore;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct addrspace *ts_as;	/* address space of the mapping */
+	vaddr_t ts_vaddr;		/* virtual page to invalidate */
+	struct semaphore *ts_done;	/* V'd once the entry is gone */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -37,6 +37,7 @@
 #include <current.h>
 #include <copyinout.h>
 #include <syscall.h>
+#include "opt-dumbvm.h"
 
 
 /*
@@ -143,6 +144,39 @@ syscall(struct trapframe *tf)
 		break;
 
 
+	    /* memory calls */
+
+#if !OPT_DUMBVM
+	    case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+		break;
+
+	    case SYS_mmap:
+		{
+			/*
+			 * The offset is 64 bits and would have to go in
+			 * an aligned register pair, but a2 is taken by
+			 * the fd, so it's on the stack like lseek's
+			 * "whence".
+			 */
+			uint64_t offset;
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     &offset, sizeof(offset));
+			if (err) {
+				break;
+			}
+			err = sys_mmap(tf->tf_a0, tf->tf_a1, tf->tf_a2,
+				       offset, &retval);
+		}
+		break;
+
+	    case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0);
+		break;
+#endif
+
+
 	    /* file calls */
 
 	    case SYS_open:
@@ -29,9 +29,15 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <wchan.h>
+#include <platform/maxcpus.h>
 
 vaddr_t firstfree;   /* first free virtual address; set by start.S */
 
@@ -42,7 +48,20 @@ static paddr_t lastpaddr;   /* one past end of last free physical page */
 
 typedef struct ft_entry {
         unsigned allocated:1; /* the corresponding frame is allocated */
-        unsigned not_last:1; /* the frame is part of a multiframe allocation */
+        unsigned free_head:1; /* the frame heads a free buddy block */
+        unsigned order:5; /* log2 size of the free block headed here */
+        unsigned owner_type:2; /* FRAME_OWNER_*: what the kernel heap uses it for */
+        unsigned refcount:23; /* number of page tables sharing the frame */
+        union {
+                struct {
+                        uint32_t next; /* free list links (frame numbers) */
+                        uint32_t prev;
+                } link; /* free block head: links on its order's list */
+                struct {
+                        uint32_t npages; /* frames in the block */
+                        void *owner; /* heap metadata, see frame_set_owner */
+                } head; /* allocation head */
+        } u;
 } ft_entry_t;
 
 
@@ -50,6 +69,23 @@ static ft_entry_t * frame_table = NULL; /* base of frame table */
 static uint32_t first_frame;
 static uint32_t last_frame;
 
+/*
+ * Free memory is managed by a binary buddy allocator. A free block of
+ * order k is 2^k frames aligned on a 2^k frame boundary; its first
+ * frame is linked on free_lists[k] through the frame table. Freeing a
+ * block merges it with its buddy (the other half of the enclosing
+ * order k+1 block) for as long as the buddy is also free.
+ *
+ * Frame 0 always belongs to the kernel (exception handlers), so 0
+ * marks the end of a list.
+ */
+#define NO_FRAME 0
+#define BUDDY_MAX_ORDER 18 /* 2^17 frames is all of kseg0 */
+
+static uint32_t free_lists[BUDDY_MAX_ORDER]; /* heads, one per order */
+static uint32_t nfree_blocks[BUDDY_MAX_ORDER]; /* blocks on each list */
+static uint32_t nfree_frames = 0; /* number of free frames in total */
+
 #define PAGE_BITS 12
 #define TRUE 1
 #define FALSE 0
@@ -61,6 +97,94 @@ static uint32_t last_frame;
 
 static struct spinlock frame_table_spinlock = SPINLOCK_INITIALIZER;
 
+/* Every cpu's frame cache, for statistics. Set up by frame_cache_init. */
+static struct frame_cache *frame_caches[MAXCPUS];
+
+/* Put the block headed by frame i on the free list for ORDER. Caller holds the lock. */
+static void freelist_push(uint32_t i, unsigned order)
+{
+        frame_table[i].allocated = FALSE;
+        frame_table[i].free_head = TRUE;
+        frame_table[i].order = order;
+        frame_table[i].u.link.prev = NO_FRAME;
+        frame_table[i].u.link.next = free_lists[order];
+        if (free_lists[order] != NO_FRAME) {
+                frame_table[free_lists[order]].u.link.prev = i;
+        }
+        free_lists[order] = i;
+        nfree_blocks[order]++;
+        nfree_frames += 1U << order;
+}
+
+/* Unlink the free block headed by frame i. Caller holds the lock. */
+static void freelist_remove(uint32_t i)
+{
+        unsigned order = frame_table[i].order;
+        uint32_t prev = frame_table[i].u.link.prev;
+        uint32_t next = frame_table[i].u.link.next;
+
+        KASSERT(frame_table[i].free_head == TRUE);
+
+        if (prev != NO_FRAME) {
+                frame_table[prev].u.link.next = next;
+        }
+        else {
+                KASSERT(free_lists[order] == i);
+                free_lists[order] = next;
+        }
+        if (next != NO_FRAME) {
+                frame_table[next].u.link.prev = prev;
+        }
+        frame_table[i].free_head = FALSE;
+        KASSERT(nfree_blocks[order] > 0);
+        nfree_blocks[order]--;
+        nfree_frames -= 1U << order;
+}
+
+/*
+ * Free the 2^order block at frame i, coalescing with free buddies.
+ * Caller holds the lock.
+ */
+static void buddy_free_block(uint32_t i, unsigned order)
+{
+        uint32_t buddy;
+
+        while (order + 1 < BUDDY_MAX_ORDER) {
+                buddy = i ^ (1U << order);
+                if (buddy < first_frame || buddy + (1U << order) > last_frame) {
+                        break;
+                }
+                if (frame_table[buddy].free_head == FALSE ||
+                    frame_table[buddy].order != order) {
+                        break;
+                }
+                freelist_remove(buddy);
+                i = i < buddy ? i : buddy;
+                order++;
+        }
+        freelist_push(i, order);
+}
+
+/*
+ * Free the arbitrary range of frames [i, end) by splitting it into the
+ * largest naturally aligned blocks that fit. Caller holds the lock.
+ */
+static void buddy_free_range(uint32_t i, uint32_t end)
+{
+        unsigned order;
+
+        while (i < end) {
+                order = 0;
+                while (order + 1 < BUDDY_MAX_ORDER &&
+                       (i & ((2U << order) - 1)) == 0 &&
+                       i + (2U << order) <= end) {
+                        order++;
+                }
+                buddy_free_block(i, order);
+                i += 1U << order;
+        }
+}
+
 /*
  * Called very early in system boot to figure out how much physical
  * RAM is available.
@@ -129,7 +253,10 @@ ram_bootstrap(void)
         for (i = 0; i < (firstpaddr >> PAGE_BITS); i++) {
                 /* Mark as allocated as individual pages */
                 frame_table[i].allocated = TRUE;
-                frame_table[i].not_last = FALSE;
+                frame_table[i].free_head = FALSE;
+                frame_table[i].owner_type = FRAME_OWNER_NONE;
+                frame_table[i].refcount = 1;
+                frame_table[i].u.head.npages = 1;
         }                                            
         
         /* 
@@ -137,10 +264,18 @@ ram_bootstrap(void)
          */
         
         first_frame = firstpaddr >> PAGE_BITS;
+        KASSERT(first_frame > NO_FRAME);
         
-        for (i = first_frame; i < (lastpaddr >> PAGE_BITS); i++) {
+        for (i = 0; i < BUDDY_MAX_ORDER; i++) {
+                free_lists[i] = NO_FRAME;
+                nfree_blocks[i] = 0;
+        }
+        for (i = first_frame; i < last_frame; i++) {
                 frame_table[i].allocated = FALSE;
+                frame_table[i].free_head = FALSE;
+                frame_table[i].refcount = 0;
         }
+        buddy_free_range(first_frame, last_frame);
 
         
 }
@@ -189,90 +324,260 @@ ram_getfirstfree(void)
 }
 
 /*
- * This is a relatively inefficient first-fit allocator. Single pages
- * always fit. Multiframe allocations can suffer from external
- * fragmentation. It is intended to be easy to understand and robust,
- * not efficient.
+ * Allocate npages contiguous frames. The request is rounded up to the
+ * next power of two, the smallest free block that big is split down to
+ * size, and any frames beyond npages are handed straight back so the
+ * caller only consumes what it asked for. Single frames come off the
+ * order 0 list directly unless it has run dry.
  */
+static uint32_t buddy_alloc(unsigned order)
+{
+        unsigned k;
+        uint32_t i;
+
+        KASSERT(spinlock_do_i_hold(&frame_table_spinlock));
+
+        for (k = order; k < BUDDY_MAX_ORDER; k++) {
+                if (free_lists[k] != NO_FRAME) {
+                        break;
+                }
+        }
+        if (k == BUDDY_MAX_ORDER) {
+                /* Did not find a large enough free block :-( */
+                return NO_FRAME;
+        }
+
+        i = free_lists[k];
+        freelist_remove(i);
 
+        /* split, keeping the lower half and freeing the upper one */
+        while (k > order) {
+                k--;
+                freelist_push(i + (1U << k), k);
+        }
+        return i;
+}
 
-static paddr_t alloc_one_frame(unsigned int npages)
+static paddr_t alloc_frames(unsigned int npages)
 {
-        unsigned int i;
+        unsigned order, k;
+        uint32_t i;
 
-        /* 
-         * Just scan from the start of the frame_table array for an
-         * unallocated block
-         */
-        
-        KASSERT(npages == 1);
+        KASSERT(npages > 0);
+
+        for (order = 0; (1U << order) < npages; order++) {
+                if (order + 1 >= BUDDY_MAX_ORDER) {
+                        return (paddr_t) 0;
+                }
+        }
 
         spinlock_acquire(&frame_table_spinlock);
-        for (i =  first_frame; i < last_frame; i++) {
-                if (frame_table[i].allocated == FALSE) {
-                        frame_table[i].allocated = TRUE;
-                        frame_table[i].not_last = FALSE;
 
-                        spinlock_release(&frame_table_spinlock);
+        i = buddy_alloc(order);
+        if (i == NO_FRAME) {
+                spinlock_release(&frame_table_spinlock);
+                return (paddr_t) 0;
+        }
 
-                        return (paddr_t) (i << PAGE_BITS);
-                }
+        /* give back the unused tail of the power-of-two block */
+        if ((1U << order) > npages) {
+                buddy_free_range(i + npages, i + (1U << order));
         }
-        
-        /* Did not find an unallocated frame :-( */
+
+        for (k = 0; k < npages; k++) {
+                KASSERT(frame_table[i + k].allocated == FALSE);
+                frame_table[i + k].allocated = TRUE;
+                frame_table[i + k].free_head = FALSE;
+        }
+        frame_table[i].refcount = 1; /* counted on the first frame */
+        frame_table[i].u.head.npages = npages;
 
         spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
+
+        return (paddr_t) (i << PAGE_BITS);
 }
 
-static paddr_t alloc_multiple_frames(unsigned int npages)
+/*
+ * Per-cpu frame caches.
+ *
+ * Each cpu keeps a small stack of free single frames in its struct
+ * cpu so the common page fault path can allocate and free without
+ * taking frame_table_spinlock. The cache is only touched by its own
+ * cpu with interrupts off; it is refilled from and drained to the
+ * buddy allocator FRAME_CACHE_BATCH frames at a time. Cached frames
+ * look allocated to the buddy allocator, with a reference count of 0.
+ */
+
+void
+frame_cache_init(struct frame_cache *fc, unsigned cpunum)
 {
-        unsigned int i,j;
+        KASSERT(cpunum < MAXCPUS);
+
+        fc->fc_count = 0;
+        fc->fc_hits = 0;
+        fc->fc_misses = 0;
+        fc->fc_frees = 0;
+        fc->fc_drains = 0;
+        fc->fc_zphits = 0;
+        fc->fc_zpmisses = 0;
+        frame_caches[cpunum] = fc;
+}
 
+/* Move up to FRAME_CACHE_BATCH free frames from the buddy allocator into FC. */
+static void frame_cache_refill(struct frame_cache *fc)
+{
+        uint32_t i;
 
-        /* scan from 'i' for the number of needed free frames. If an
-         * allocated frame is encountered, restart the scan from after
-         * that point.
-         */
-        
+        spinlock_acquire(&frame_table_spinlock);
+        while (fc->fc_count < FRAME_CACHE_BATCH) {
+                i = buddy_alloc(0);
+                if (i == NO_FRAME) {
+                        break;
+                }
+                frame_table[i].allocated = TRUE;
+                frame_table[i].refcount = 0;
+                frame_table[i].u.head.npages = 1;
+                fc->fc_frames[fc->fc_count++] = i;
+        }
+        spinlock_release(&frame_table_spinlock);
+}
+
+/* Hand FRAME_CACHE_BATCH frames from a full FC back to the buddy allocator. */
+static void frame_cache_drain(struct frame_cache *fc)
+{
+        uint32_t i;
+        unsigned n;
 
         spinlock_acquire(&frame_table_spinlock);
+        for (n = 0; n < FRAME_CACHE_BATCH && fc->fc_count > 0; n++) {
+                i = fc->fc_frames[--fc->fc_count];
+                KASSERT(frame_table[i].refcount == 0);
+                frame_table[i].allocated = FALSE;
+                buddy_free_block(i, 0);
+        }
+        spinlock_release(&frame_table_spinlock);
+        fc->fc_drains++;
+}
 
-        i = first_frame; j = 0;
+/*
+ * Pre-zeroed frames.
+ *
+ * Anonymous user pages have to start out zeroed. Instead of clearing
+ * each one in the fault path, the "zero" kernel thread keeps a pool
+ * of frames that are already clear, and alloc_zeroed_kpage() takes
+ * from it. OS/161 has no idle priority, so the thread yields after
+ * every frame and sleeps once the pool is full; allocations wake it
+ * when the pool drops below ZERO_POOL_LOW. It stops short of the last
+ * ZERO_POOL_MINFREE free frames so it never pushes the pager into
+ * evicting just to make zeroed pages.
+ *
+ * Pool frames look allocated with a refcount of 0, like cached ones,
+ * but they are still free memory: frame_table_stats counts them, and
+ * ordinary allocations fall back on them when nothing else is left.
+ * The pool is protected by frame_table_spinlock. Hits and misses are
+ * counted in the per-cpu frame caches, so the fault path takes the
+ * lock only once; ft1 measures what the pool saves.
+ */
+#define ZERO_POOL_SIZE    64
+#define ZERO_POOL_LOW     16
+#define ZERO_POOL_MINFREE 32
 
-        while (i < (last_frame - npages) && j < npages) {
-                if (frame_table[i+j].allocated == TRUE) {
-                        i = i + j + 1; /* continue scan after allocated frame */
-                        j = 0;         /* restart the count */
-                }
-                else {
-                        j = j + 1; /* increment count of free frames */
-                }
+static uint32_t zero_pool[ZERO_POOL_SIZE];
+static unsigned zero_pool_count = 0;
+static bool zero_pool_enabled = false; /* set by frame_zero_bootstrap */
+static struct wchan *zero_wchan;
+
+static unsigned zp_zeroed;
+
+/* Take a frame out of the zero pool as an ordinary allocation. */
+static paddr_t zero_pool_steal(void)
+{
+        uint32_t i = NO_FRAME;
+
+        spinlock_acquire(&frame_table_spinlock);
+        if (zero_pool_count > 0) {
+                i = zero_pool[--zero_pool_count];
+                frame_table[i].refcount = 1;
         }
+        spinlock_release(&frame_table_spinlock);
 
-        if  (j == npages) { /* we exited as we found the number of frames required. */
-                for (j = i; j < i + npages - 1; j++) {
-                        frame_table[j].allocated = TRUE; /* mark frame allocated */
-                        frame_table[j].not_last = TRUE;  /* as a contiguous block */
+        return (paddr_t) (i << PAGE_BITS);
+}
+
+static paddr_t alloc_one_frame(void)
+{
+        struct frame_cache *fc;
+        uint32_t i;
+        int spl;
+
+        if (!CURCPU_EXISTS()) {
+                /* too early in boot for per-cpu state */
+                return alloc_frames(1);
+        }
+
+        spl = splhigh();
+        fc = &curcpu->c_framecache;
+        if (fc->fc_count > 0) {
+                fc->fc_hits++;
+        }
+        else {
+                fc->fc_misses++;
+                frame_cache_refill(fc);
+                if (fc->fc_count == 0) {
+                        splx(spl);
+                        return zero_pool_steal();
                 }
-                frame_table[j].allocated = TRUE;
-                frame_table[j].not_last = FALSE;
+        }
+        i = fc->fc_frames[--fc->fc_count];
+        KASSERT(frame_table[i].allocated == TRUE);
+        frame_table[i].refcount = 1;
+        splx(spl);
 
-                spinlock_release(&frame_table_spinlock);
-                
-                return (paddr_t) (i << PAGE_BITS);
+        return (paddr_t) (i << PAGE_BITS);
+}
+
+/*
+ * Try to put frame i in this cpu's cache. Only unshared single frames
+ * qualify; since we hold the only reference nobody else can change
+ * the refcount, so it is safe to look at without the lock.
+ */
+static bool free_one_frame(uint32_t i)
+{
+        struct frame_cache *fc;
+        int spl;
+
+        if (!CURCPU_EXISTS() || frame_table[i].allocated == FALSE ||
+            frame_table[i].u.head.npages != 1 || frame_table[i].refcount != 1) {
+                return false;
         }
-        
-        /* Did not find an unallocated contiguous range of frames :-( */
 
-        spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
+        spl = splhigh();
+        fc = &curcpu->c_framecache;
+        if (fc->fc_count == FRAME_CACHE_SIZE) {
+                frame_cache_drain(fc);
+        }
+        frame_table[i].refcount = 0;
+        fc->fc_frames[fc->fc_count++] = i;
+        fc->fc_frees++;
+        splx(spl);
+
+        return true;
+}
+
+/*
+ * A newly allocated block belongs to nobody yet. Only its first frame
+ * carries an owner, and only its holder touches it, so no lock.
+ */
+static void frame_clear_owner(uint32_t i)
+{
+        frame_table[i].owner_type = FRAME_OWNER_NONE;
+        frame_table[i].u.head.owner = NULL;
 }
 
 static void free_frames(vaddr_t vaddr)
 {
         paddr_t paddr;
-        uint32_t i;
+        uint32_t i, k, npages;
 
         KASSERT(vaddr != (vaddr_t) NULL);
 
@@ -280,18 +585,30 @@ static void free_frames(vaddr_t vaddr)
 
         i = paddr >> PAGE_BITS;
 
+        if (free_one_frame(i)) {
+                return;
+        }
+
         spinlock_acquire(&frame_table_spinlock);
 
         if (frame_table[i].allocated == FALSE) { /* check for double free error */
                 panic("Double free error!!");
         }
-        
-        while (frame_table[i].allocated == TRUE) { /* otherwise mark block free */
-                frame_table[i].allocated = FALSE;
-                if (frame_table[i].not_last == TRUE) {
-                        i++;
-                }
+
+        KASSERT(frame_table[i].refcount > 0);
+        if (--frame_table[i].refcount > 0) { /* still shared, keep it */
+                spinlock_release(&frame_table_spinlock);
+                return;
+        }
+
+        npages = frame_table[i].u.head.npages;
+        KASSERT(npages > 0 && i + npages <= last_frame);
+        for (k = i; k < i + npages; k++) { /* otherwise mark block free */
+                KASSERT(frame_table[k].allocated == TRUE);
+                frame_table[k].allocated = FALSE;
         }
+        buddy_free_range(i, i + npages);
+
         spinlock_release(&frame_table_spinlock);
 }
         
@@ -300,16 +617,18 @@ vaddr_t
 alloc_kpages(unsigned npages)
 {
         paddr_t paddr;
-        if (npages > 1 ) {
-                paddr = alloc_multiple_frames(npages);
+
+        if (npages == 1) {
+                paddr = alloc_one_frame();
         }
         else {
-                paddr = alloc_one_frame(npages);
+                paddr = alloc_frames(npages);
         }
         
 	if (paddr == 0) {
 		return 0;
 	}
+        frame_clear_owner(paddr >> PAGE_BITS);
 	return PADDR_TO_KVADDR(paddr);
 }
 
@@ -319,3 +638,304 @@ free_kpages(vaddr_t addr)
         free_frames(addr);
 }
 
+/*
+ * Allocate one frame whose contents are zero, from the zero pool if
+ * possible.
+ */
+vaddr_t
+alloc_zeroed_kpage(void)
+{
+        uint32_t i = NO_FRAME;
+        vaddr_t vaddr;
+
+        spinlock_acquire(&frame_table_spinlock);
+        if (zero_pool_enabled) {
+                if (zero_pool_count > 0) {
+                        i = zero_pool[--zero_pool_count];
+                        frame_table[i].refcount = 1;
+                }
+                /* the spinlock has interrupts off, so curcpu is ours */
+                if (CURCPU_EXISTS()) {
+                        if (i != NO_FRAME) {
+                                curcpu->c_framecache.fc_zphits++;
+                        }
+                        else {
+                                curcpu->c_framecache.fc_zpmisses++;
+                        }
+                }
+                if (zero_pool_count < ZERO_POOL_LOW) {
+                        wchan_wakeone(zero_wchan, &frame_table_spinlock);
+                }
+        }
+        spinlock_release(&frame_table_spinlock);
+
+        if (i != NO_FRAME) {
+                frame_clear_owner(i);
+                vaddr = PADDR_TO_KVADDR(i << PAGE_BITS);
+        }
+        else {
+                vaddr = alloc_kpages(1);
+                if (vaddr == 0) {
+                        return 0;
+                }
+                bzero((void *)vaddr, PAGE_SIZE);
+        }
+        return vaddr;
+}
+
+static void
+zero_thread(void *data1, unsigned long data2)
+{
+        uint32_t i;
+
+        (void)data1;
+        (void)data2;
+
+        spinlock_acquire(&frame_table_spinlock);
+        while (1) {
+                if (!zero_pool_enabled ||
+                    zero_pool_count >= ZERO_POOL_SIZE ||
+                    nfree_frames <= ZERO_POOL_MINFREE) {
+                        wchan_sleep(zero_wchan, &frame_table_spinlock);
+                        continue;
+                }
+                i = buddy_alloc(0);
+                KASSERT(i != NO_FRAME);
+                frame_table[i].allocated = TRUE;
+                frame_table[i].refcount = 0;
+                frame_table[i].u.head.npages = 1;
+                spinlock_release(&frame_table_spinlock);
+
+                bzero((void *)PADDR_TO_KVADDR(i << PAGE_BITS), PAGE_SIZE);
+                /* let anything with real work to do go first */
+                thread_yield();
+
+                spinlock_acquire(&frame_table_spinlock);
+                if (!zero_pool_enabled) {
+                        /* switched off meanwhile */
+                        frame_table[i].allocated = FALSE;
+                        buddy_free_block(i, 0);
+                        continue;
+                }
+                /* only we add to the pool, so there is still room */
+                KASSERT(zero_pool_count < ZERO_POOL_SIZE);
+                zero_pool[zero_pool_count++] = i;
+                zp_zeroed++;
+        }
+}
+
+/*
+ * Start the zeroing thread. Called from vm_bootstrap; until then
+ * alloc_zeroed_kpage simply clears the frames itself.
+ */
+void
+frame_zero_bootstrap(void)
+{
+        int result;
+
+        zero_wchan = wchan_create("zero pool");
+        if (zero_wchan == NULL) {
+                panic("vm: cannot create zero pool wchan\n");
+        }
+        result = thread_fork("zero", NULL, zero_thread, NULL, 0);
+        if (result) {
+                panic("vm: cannot start zeroing thread: %s\n",
+                      strerror(result));
+        }
+        frame_zero_pool_set(true);
+}
+
+/* Turn the zero pool on or off; turning it off frees its frames. */
+void
+frame_zero_pool_set(bool on)
+{
+        uint32_t i;
+
+        spinlock_acquire(&frame_table_spinlock);
+        zero_pool_enabled = on;
+        if (on) {
+                wchan_wakeone(zero_wchan, &frame_table_spinlock);
+        }
+        else {
+                while (zero_pool_count > 0) {
+                        i = zero_pool[--zero_pool_count];
+                        frame_table[i].allocated = FALSE;
+                        buddy_free_block(i, 0);
+                }
+        }
+        spinlock_release(&frame_table_spinlock);
+}
+
+bool
+frame_zero_pool_get(void)
+{
+        return zero_pool_enabled;
+}
+
+/*
+ * Reference counting for frames shared between page tables by
+ * copy-on-write fork. A frame starts with one reference when it is
+ * allocated; free_kpages() drops a reference and only releases the
+ * frame once the last one is gone.
+ */
+void
+frame_incref(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].refcount > 0);
+        frame_table[i].refcount++;
+        spinlock_release(&frame_table_spinlock);
+}
+
+unsigned
+frame_getref(paddr_t paddr)
+{
+        unsigned refcount;
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        refcount = frame_table[i].refcount;
+        spinlock_release(&frame_table_spinlock);
+
+        return refcount;
+}
+
+/*
+ * Record what the kernel heap keeps in the page at VADDR, which must
+ * be part of a block the caller has from alloc_kpages. The entry is
+ * the caller's until the block is freed, so no lock is needed to set
+ * or read it. For a block of several pages, the caller tags each page
+ * it wants found and must clear them again before freeing; only the
+ * first is cleared on allocation.
+ */
+void
+frame_set_owner(vaddr_t vaddr, unsigned type, void *owner)
+{
+        uint32_t i = KVADDR_TO_PADDR(vaddr) >> PAGE_BITS;
+
+        KASSERT(i >= first_frame && i < last_frame);
+        KASSERT(frame_table[i].allocated == TRUE);
+
+        frame_table[i].owner_type = type;
+        frame_table[i].u.head.owner = owner;
+}
+
+/*
+ * Look up the owner of the heap page holding VADDR, in constant time.
+ * VADDR must be a block kmalloc handed out and has not freed, so its
+ * page is allocated; anything not tagged comes back FRAME_OWNER_NONE.
+ */
+void *
+frame_get_owner(vaddr_t vaddr, unsigned *type)
+{
+        uint32_t i = KVADDR_TO_PADDR(vaddr) >> PAGE_BITS;
+
+        if (i < first_frame || i >= last_frame ||
+            frame_table[i].allocated == FALSE ||
+            frame_table[i].owner_type == FRAME_OWNER_NONE) {
+                *type = FRAME_OWNER_NONE;
+                return NULL;
+        }
+        *type = frame_table[i].owner_type;
+        return frame_table[i].u.head.owner;
+}
+
+/*
+ * Report the number of frames managed by the allocator and how many
+ * of them are currently free.
+ */
+void
+frame_table_stats(unsigned *nframes, unsigned *nfree)
+{
+        unsigned n;
+
+        spinlock_acquire(&frame_table_spinlock);
+        *nframes = last_frame - first_frame;
+        *nfree = nfree_frames + zero_pool_count;
+        spinlock_release(&frame_table_spinlock);
+
+        /* frames sitting in per-cpu caches are free too */
+        for (n = 0; n < MAXCPUS; n++) {
+                if (frame_caches[n] != NULL) {
+                        *nfree += frame_caches[n]->fc_count;
+                }
+        }
+}
+
+/*
+ * Cheap estimate of free memory for the pager's low-water check: free
+ * buddy blocks and the zero pool, read without the lock, so it may be
+ * a moment stale. Frames in per-cpu caches are left out; at most
+ * FRAME_CACHE_SIZE per cpu, and they go to their own cpu first anyway.
+ */
+unsigned
+frame_table_nfree(void)
+{
+        return *(volatile uint32_t *)&nfree_frames +
+                *(volatile unsigned *)&zero_pool_count;
+}
+
+/*
+ * Print buddy allocator state: free blocks per order, and how badly
+ * free memory is fragmented. The fragmentation figure is the share
+ * of free memory that lies outside the largest free block, so 0%
+ * means every free frame could serve a single contiguous request.
+ */
+void
+frame_table_printstats(void)
+{
+        unsigned order, largest, n, allocs;
+        struct frame_cache *fc;
+        uint32_t blocks[BUDDY_MAX_ORDER];
+        uint32_t nfree, nframes, npool;
+        unsigned hits, misses, zeroed;
+
+        spinlock_acquire(&frame_table_spinlock);
+        for (order = 0; order < BUDDY_MAX_ORDER; order++) {
+                blocks[order] = nfree_blocks[order];
+        }
+        nfree = nfree_frames;
+        nframes = last_frame - first_frame;
+        npool = zero_pool_count;
+        zeroed = zp_zeroed;
+        spinlock_release(&frame_table_spinlock);
+
+        kprintf("Frame allocator status: %u/%u frames free\n",
+                nfree, nframes);
+        largest = 0;
+        for (order = 0; order < BUDDY_MAX_ORDER; order++) {
+                if (blocks[order] == 0) {
+                        continue;
+                }
+                kprintf("   order %2u (%6u pages): %u free\n",
+                        order, 1U << order, blocks[order]);
+                largest = 1U << order;
+        }
+        kprintf("   largest free block %u pages, fragmentation %u%%\n",
+                largest, nfree ? 100 - (largest * 100) / nfree : 0);
+
+        hits = misses = 0;
+        for (n = 0; n < MAXCPUS; n++) {
+                fc = frame_caches[n];
+                if (fc == NULL) {
+                        continue;
+                }
+                hits += fc->fc_zphits;
+                misses += fc->fc_zpmisses;
+                allocs = fc->fc_hits + fc->fc_misses;
+                kprintf("   cpu%u frame cache: %u cached, %u/%u hits (%u%%), "
+                        "%u frees, %u drains\n",
+                        n, fc->fc_count, fc->fc_hits, allocs,
+                        allocs ? (fc->fc_hits * 100) / allocs : 0,
+                        fc->fc_frees, fc->fc_drains);
+        }
+
+        kprintf("   zero pool %s: %u/%u frames, %u zeroed in background, "
+                "%u/%u hits (%u%%)\n",
+                zero_pool_enabled ? "on" : "off", npool, ZERO_POOL_SIZE,
+                zeroed, hits, hits + misses,
+                hits + misses ? (hits * 100) / (hits + misses) : 0);
+}
@@ -854,10 +854,31 @@ emufs_namefile(struct vnode *v, struct uio *uio)
  */
 static
 int
-emufs_mmap(struct vnode *v)
+emufs_mmap(struct vnode *v, off_t offset, size_t len, size_t *backed)
 {
-	(void)v;
-	return ENOSYS;
+	struct emufs_vnode *ev = v->vn_data;
+	off_t size;
+	int result;
+
+	if (offset < 0) {
+		return EINVAL;
+	}
+
+	result = emu_getsize(ev->ev_emu, ev->ev_handle, &size);
+	if (result) {
+		return result;
+	}
+
+	if (size <= offset) {
+		*backed = 0;
+	}
+	else if (size - offset < (off_t)len) {
+		*backed = size - offset;
+	}
+	else {
+		*backed = len;
+	}
+	return 0;
 }
 
 //////////////////////////////
@@ -1127,7 +1148,7 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_gettype = emufs_dir_gettype,
 	.vop_isseekable = emufs_isseekable,
 	.vop_fsync = emufs_void_op_isdir,
-	.vop_mmap = emufs_void_op_isdir,
+	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = emufs_truncate_isdir,
 	.vop_namefile = emufs_namefile,
 
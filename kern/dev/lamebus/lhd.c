@@ -36,7 +36,8 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -96,15 +97,146 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Request scheduling.
+ *
+ * Pending requests sit on lh_queue in arrival order and are started
+ * one at a time by the interrupt handler, so the disk goes straight
+ * from one request to the next with no thread in between. The next
+ * request is picked C-LOOK: the lowest sector at or past the head,
+ * or, if there is none, the lowest sector overall. To keep a request
+ * at the far end of the disk from being passed over forever, one that
+ * has waited through LHD_DEADLINE dispatches goes next regardless.
+ */
+#define LHD_DEADLINE    16
+
+/*
+ * Choose the next request and return the link pointing to it.
+ * Call with lh_lock held and the queue nonempty.
+ */
+static
+struct device_req **
+lhd_pick(struct lhd_softc *lh)
+{
+	struct device_req **link, **ahead, **lowest;
+	struct device_req *req;
+
+	KASSERT(lh->lh_queue != NULL);
+
+	/* The oldest request is overdue; take it. */
+	if ((int32_t)(lh->lh_ndispatch - lh->lh_queue->dr_expire) >= 0) {
+		return &lh->lh_queue;
+	}
+
+	ahead = lowest = NULL;
+	for (link = &lh->lh_queue; *link != NULL; link = &(*link)->dr_next) {
+		req = *link;
+		if (lowest == NULL || req->dr_block < (*lowest)->dr_block) {
+			lowest = link;
+		}
+		if (req->dr_block >= lh->lh_headpos &&
+		    (ahead == NULL || req->dr_block < (*ahead)->dr_block)) {
+			ahead = link;
+		}
+	}
+	return ahead != NULL ? ahead : lowest;
+}
+
+/*
+ * Start the next sector of the active request.
+ * Call with lh_lock held.
+ */
+static
+void
+lhd_startsector(struct lhd_softc *lh)
+{
+	struct device_req *req = lh->lh_active;
+	char *data = (char *)req->dr_data + req->dr_ndone * LHD_SECTSIZE;
+	uint32_t statval = LHD_WORKING;
+
+	/*
+	 * Are we writing? If so, transfer the data to the
+	 * on-card buffer.
+	 */
+	if (req->dr_write) {
+		memcpy(lh->lh_buf, data, LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, req->dr_block + req->dr_ndone);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * If the disk is idle and there's something queued, start it.
+ * Call with lh_lock held.
+ */
+static
+void
+lhd_dispatch(struct lhd_softc *lh)
+{
+	struct device_req **link;
+
+	if (lh->lh_active != NULL || lh->lh_queue == NULL) {
+		return;
+	}
+
+	link = lhd_pick(lh);
+	lh->lh_active = *link;
+	*link = lh->lh_active->dr_next;
+	lh->lh_active->dr_next = NULL;
+	lh->lh_ndispatch++;
+
+	lhd_startsector(lh);
+}
+
+/*
+ * A sector of the active request has finished with result ERR. Copy
+ * the data out if it was a read, then go on to the next sector, or
+ * finish the request, wake its waiter, and start the next one.
+ * Call with lh_lock held.
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct device_req *req = lh->lh_active;
+
+	if (req == NULL) {
+		/* Not ours; nothing was started. */
+		return;
+	}
+
+	if (err == 0) {
+		/*
+		 * Are we reading? If so, transfer the data out of the
+		 * on-card buffer.
+		 */
+		if (!req->dr_write) {
+			membar_load_load();
+			memcpy((char *)req->dr_data +
+			       req->dr_ndone * LHD_SECTSIZE,
+			       lh->lh_buf, LHD_SECTSIZE);
+		}
+		req->dr_ndone++;
+		lh->lh_headpos = req->dr_block + req->dr_ndone;
+
+		if (req->dr_ndone < req->dr_nblocks) {
+			lhd_startsector(lh);
+			return;
+		}
+	}
+
+	/* Finished, or failed; stop here. */
+	req->dr_result = err;
+	req->dr_complete = true;
+	lh->lh_active = NULL;
+	wchan_wakeall(lh->lh_wchan, &lh->lh_lock);
+
+	lhd_dispatch(lh);
 }
 
 /*
@@ -118,6 +250,8 @@ lhd_irq(void *vlh)
 	struct lhd_softc *lh = vlh;
 	uint32_t val;
 
+	spinlock_acquire(&lh->lh_lock);
+
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
@@ -131,6 +265,60 @@ lhd_irq(void *vlh)
 		lhd_iodone(lh, lhd_code_to_errno(lh, val));
 		break;
 	}
+
+	spinlock_release(&lh->lh_lock);
+}
+
+/*
+ * Queue a request and return without waiting for it.
+ */
+static
+int
+lhd_submit(struct device *d, struct device_req *req)
+{
+	struct lhd_softc *lh = d->d_data;
+	struct device_req **link;
+
+	/* Don't allow empty I/O or I/O past the end of the disk. */
+	if (req->dr_nblocks == 0 ||
+	    req->dr_nblocks > lh->lh_dev.d_blocks ||
+	    req->dr_block > lh->lh_dev.d_blocks - req->dr_nblocks) {
+		return EINVAL;
+	}
+
+	req->dr_ndone = 0;
+	req->dr_result = 0;
+	req->dr_complete = false;
+	req->dr_next = NULL;
+
+	spinlock_acquire(&lh->lh_lock);
+	req->dr_expire = lh->lh_ndispatch + LHD_DEADLINE;
+	for (link = &lh->lh_queue; *link != NULL; link = &(*link)->dr_next) {
+		/* nothing */
+	}
+	*link = req;
+	lhd_dispatch(lh);
+	spinlock_release(&lh->lh_lock);
+
+	return 0;
+}
+
+/*
+ * Wait for a submitted request to finish.
+ */
+static
+int
+lhd_wait(struct device *d, struct device_req *req)
+{
+	struct lhd_softc *lh = d->d_data;
+
+	spinlock_acquire(&lh->lh_lock);
+	while (!req->dr_complete) {
+		wchan_sleep(lh->lh_wchan, &lh->lh_lock);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	return req->dr_result;
 }
 
 /*
@@ -179,22 +367,62 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Do one request synchronously. Return the result and, in *NDONE,
+ * the number of sectors transferred.
+ */
+static
+int
+lhd_rw(struct lhd_softc *lh, uint32_t sector, uint32_t nsect,
+       void *data, bool write, uint32_t *ndone)
+{
+	struct device_req req;
+	int result;
+
+	req.dr_block = sector;
+	req.dr_nblocks = nsect;
+	req.dr_data = data;
+	req.dr_write = write;
+
+	*ndone = 0;
+	result = lhd_submit(&lh->lh_dev, &req);
+	if (result) {
+		return result;
+	}
+	result = lhd_wait(&lh->lh_dev, &req);
+	*ndone = req.dr_ndone;
+	return result;
+}
+
+/*
+ * Number of sectors moved at a time through the bounce buffer.
+ */
+#define LHD_BOUNCESECT  8
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * This goes through the request queue like everything else. A
+ * single kernel buffer is handed to the interrupt handler directly;
+ * anything else (user memory, or several iovecs) is staged through
+ * a bounce buffer a few sectors at a time, since the interrupt
+ * handler can't run uiomove.
  */
 static
 int
 lhd_io(struct device *d, struct uio *uio)
 {
 	struct lhd_softc *lh = d->d_data;
+	struct iovec *iov = uio->uio_iov;
+	bool write = (uio->uio_rw == UIO_WRITE);
 
 	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
-	int result;
+	uint32_t n, ndone;
+	void *bounce;
+	int result = 0;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -202,72 +430,64 @@ lhd_io(struct device *d, struct uio *uio)
 	}
 
 	/* Don't allow I/O past the end of the disk. */
-	/* XXX this check can overflow */
-	if (sector+len > lh->lh_dev.d_blocks) {
+	if (len > lh->lh_dev.d_blocks || sector > lh->lh_dev.d_blocks - len) {
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1 &&
+	    iov->iov_len == uio->uio_resid) {
+		result = lhd_rw(lh, sector, len, iov->iov_kbase, write,
+				&ndone);
+
+		/* Account for what was transferred, as uiomove would. */
+		iov->iov_kbase = (char *)iov->iov_kbase + ndone*LHD_SECTSIZE;
+		iov->iov_len -= ndone * LHD_SECTSIZE;
+		uio->uio_offset += ndone * LHD_SECTSIZE;
+		uio->uio_resid -= ndone * LHD_SECTSIZE;
+		return result;
+	}
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	bounce = kmalloc(LHD_BOUNCESECT * LHD_SECTSIZE);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
+	while (len > 0) {
+		n = len < LHD_BOUNCESECT ? len : LHD_BOUNCESECT;
+		if (write) {
+			result = uiomove(bounce, n * LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		result = lhd_rw(lh, sector, n, bounce, write, &ndone);
 		if (result) {
-			return result;
+			break;
+		}
+		if (!write) {
+			result = uiomove(bounce, n * LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
 		}
+		sector += n;
+		len -= n;
 	}
 
-	return 0;
+	kfree(bounce);
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
 	.devop_eachopen = lhd_eachopen,
 	.devop_io = lhd_io,
 	.devop_ioctl = lhd_ioctl,
+	.devop_submit = lhd_submit,
+	.devop_wait = lhd_wait,
 };
 
 /*
@@ -284,17 +504,16 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+	/* Set up the request queue. */
+	lh->lh_wchan = wchan_create("lhd");
+	if (lh->lh_wchan == NULL) {
 		return ENOMEM;
 	}
+	spinlock_init(&lh->lh_lock);
+	lh->lh_queue = NULL;
+	lh->lh_active = NULL;
+	lh->lh_headpos = 0;
+	lh->lh_ndispatch = 0;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_ops = &lhd_devops;
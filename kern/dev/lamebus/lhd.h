@@ -30,6 +30,7 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
 #include <device.h>
 
 /*
@@ -51,9 +52,12 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* Protects the request queue */
+	struct wchan *lh_wchan;		/* Waiters for completed requests */
+	struct device_req *lh_queue;	/* Pending requests, oldest first */
+	struct device_req *lh_active;	/* Request on the disk, or NULL */
+	uint32_t lh_headpos;		/* Sector after the last one done */
+	uint32_t lh_ndispatch;		/* Requests started so far */
 
 	struct device lh_dev;		/* VFS device structure */
 };
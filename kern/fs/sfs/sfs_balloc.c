@@ -33,37 +33,71 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Zero out a disk block.
+ * Zero out a disk block. This only needs a zeroed, dirty buffer; the
+ * zeros reach the disk with whatever is written there next.
  */
 static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct sfs_buf *buf;
+	int result;
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+	result = sfs_buf_get(sfs, block, false, &buf);
+	if (result) {
+		return result;
+	}
+	bzero(sfs_buf_data(buf), SFS_BLOCKSIZE);
+	sfs_buf_markdirty(buf);
+	sfs_buf_release(buf);
+	return 0;
 }
 
 /*
- * Allocate a block.
+ * Check that a block can be allocated without taking the room held
+ * for delayed buffers: one block each, plus one for an indirect
+ * block, so they can always be given blocks later (see
+ * sfs_buf_candelay). A delayed buffer that is being given its blocks
+ * (DELAYED set) allocates out of its own share.
  */
+static
+bool
+sfs_bavail(struct sfs_fs *sfs, bool delayed)
+{
+	uint32_t reserved = 2 * sfs->sfs_ndelayed;
+
+	if (delayed) {
+		KASSERT(reserved >= 2);
+		reserved -= 2;
+	}
+	return sfs->sfs_nfree > reserved;
+}
+
+/*
+ * Allocate a block and clear it.
+ */
+static
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_doballoc(struct sfs_fs *sfs, bool delayed, daddr_t *diskblock)
 {
 	int result;
 
+	if (!sfs_bavail(sfs, delayed)) {
+		return ENOSPC;
+	}
 	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
 	if (result) {
 		return result;
 	}
 	sfs->sfs_freemapdirty = true;
+	sfs->sfs_nfree--;
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
@@ -74,10 +108,65 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
 		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		sfs->sfs_nfree++;
 	}
 	return result;
 }
 
+/*
+ * Allocate a block.
+ */
+int
+sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+{
+	return sfs_doballoc(sfs, false, diskblock);
+}
+
+/*
+ * Allocate a block (e.g. an indirect block) for a delayed buffer
+ * that is being given its disk block, from the room held for it.
+ */
+int
+sfs_balloc_delayed(struct sfs_fs *sfs, daddr_t *diskblock)
+{
+	return sfs_doballoc(sfs, true, diskblock);
+}
+
+/*
+ * Allocate the block for a delayed buffer, whose data is about to be
+ * written over all of it, so it isn't cleared. Take GOAL if it's
+ * free, so consecutive file blocks allocated together land together
+ * on disk. Like sfs_balloc_delayed, this uses the room held for the
+ * buffer.
+ */
+int
+sfs_balloc_near(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
+{
+	int result;
+
+	if (!sfs_bavail(sfs, true)) {
+		return ENOSPC;
+	}
+	if (goal != 0 && goal < sfs->sfs_sb.sb_nblocks &&
+	    !bitmap_isset(sfs->sfs_freemap, goal)) {
+		bitmap_mark(sfs->sfs_freemap, goal);
+		*diskblock = goal;
+	}
+	else {
+		result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+		if (result) {
+			return result;
+		}
+		if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
+			panic("sfs: %s: balloc: invalid block %u\n",
+			      sfs->sfs_sb.sb_volname, *diskblock);
+		}
+	}
+	sfs->sfs_freemapdirty = true;
+	sfs->sfs_nfree--;
+	return 0;
+}
+
 /*
  * Free a block.
  */
@@ -86,6 +175,8 @@ sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
 	sfs->sfs_freemapdirty = true;
+	sfs->sfs_nfree++;
+	sfs_buf_invalidate(sfs, diskblock);
 }
 
 /*
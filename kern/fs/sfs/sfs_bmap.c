@@ -39,34 +39,42 @@
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Allocate a data block for sfs_dobmap: a cleared one, or if GOAL
+ * isn't NULL, an uncleared one near *GOAL.
+ */
+static
+int
+sfs_bmap_balloc(struct sfs_fs *sfs, const daddr_t *goal, daddr_t *block)
+{
+	if (goal != NULL) {
+		return sfs_balloc_near(sfs, *goal, block);
+	}
+	return sfs_balloc(sfs, block);
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * allocated, as described for sfs_bmap_balloc.
  */
+static
 int
-sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
-	 daddr_t *diskblock)
+sfs_dobmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+	   const daddr_t *goal, daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	uint32_t *idbuf;
 	daddr_t block;
 	daddr_t idblock;
 	uint32_t idnum, idoff;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	COMPILE_ASSERT(SFS_DBPERIDB * sizeof(uint32_t) == SFS_BLOCKSIZE);
 
-	/* Since we're using a static buffer, we'd better be locked. */
+	/* The buffer cache needs the big lock. */
 	KASSERT(vfs_biglock_do_i_hold());
 
 	/*
@@ -82,7 +90,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			result = sfs_bmap_balloc(sfs, goal, &block);
 			if (result) {
 				return result;
 			}
@@ -143,7 +151,13 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * the indirect block. Thus, we need to allocate an
 		 * indirect block.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		if (goal != NULL) {
+			/* for a delayed buffer; use its reserved room */
+			result = sfs_balloc_delayed(sfs, &idblock);
+		}
+		else {
+			result = sfs_balloc(sfs, &idblock);
+		}
 		if (result) {
 			return result;
 		}
@@ -154,38 +168,38 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		/* Mark the inode dirty */
 		sv->sv_dirty = true;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+		/* sfs_balloc zeroed it, so it maps no blocks yet */
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+
+	/*
+	 * Load the indirect block. Keep it pinned in case we need to
+	 * allocate, which goes through the cache too.
+	 */
+	result = sfs_buf_get(sfs, idblock, true, &buf);
+	if (result) {
+		return result;
 	}
+	sfs_buf_setowner(buf, sv);
+	idbuf = sfs_buf_data(buf);
 
 	/* Get the block out of the indirect block buffer */
 	block = idbuf[idoff];
 
 	/* If there's no block there, allocate one */
 	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+		result = sfs_bmap_balloc(sfs, goal, &block);
 		if (result) {
+			sfs_buf_release(buf);
 			return result;
 		}
 
 		/* Remember the block we allocated */
 		idbuf[idoff] = block;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+		/* The indirect block is now dirty */
+		sfs_buf_markdirty(buf);
 	}
+	sfs_buf_release(buf);
 
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
@@ -197,22 +211,39 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	return 0;
 }
 
+/*
+ * Look up a block, allocating (and clearing) it if it doesn't exist
+ * and DOALLOC is set.
+ */
+int
+sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+	 daddr_t *diskblock)
+{
+	return sfs_dobmap(sv, fileblock, doalloc, NULL, diskblock);
+}
+
+/*
+ * Allocate the disk block for a delayed-allocation file block, near
+ * GOAL. The caller has the data and writes all of it, so the block
+ * isn't cleared. The blocks come out of the room sfs_balloc holds for
+ * the delayed buffer, which must still be counted as delayed.
+ */
+int
+sfs_bmap_delayed(struct sfs_vnode *sv, uint32_t fileblock, daddr_t goal,
+		 daddr_t *diskblock)
+{
+	return sfs_dobmap(sv, fileblock, true, &goal, diskblock);
+}
+
 /*
  * Called for ftruncate() and from sfs_reclaim.
  */
 int
 sfs_itrunc(struct sfs_vnode *sv, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	uint32_t *idbuf;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
@@ -223,10 +254,11 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	int result;
 	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
 	vfs_biglock_acquire();
 
+	/* Forget data past the end that was never given disk blocks */
+	sfs_buf_dropdelayed(sv, blocklen);
+
 	/*
 	 * Go through the direct blocks. Discard any that are
 	 * past the limit we're truncating to.
@@ -253,11 +285,13 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		/* We're past the proposed EOF; may need to free stuff */
 
 		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = sfs_buf_get(sfs, idblock, true, &buf);
 		if (result) {
 			vfs_biglock_release();
 			return result;
 		}
+		sfs_buf_setowner(buf, sv);
+		idbuf = sfs_buf_data(buf);
 
 		hasnonzero = 0;
 		iddirty = 0;
@@ -276,18 +310,17 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 
 		if (!hasnonzero) {
 			/* The whole indirect block is empty now; free it */
+			sfs_buf_release(buf);
 			sfs_bfree(sfs, idblock);
 			sv->sv_i.sfi_indirect = 0;
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
+		else {
+			/* If the indirect block is dirty, it goes out later */
+			if (iddirty) {
+				sfs_buf_markdirty(buf);
 			}
+			sfs_buf_release(buf);
 		}
 	}
 
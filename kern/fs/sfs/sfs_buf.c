@@ -0,0 +1,1149 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Block buffer cache.
+ *
+ * A fixed pool of SFS_NBUFS block buffers shared by all mounted SFS
+ * volumes. Buffers are found by (volume, block) through a hash table
+ * and recycled in least recently used order. Writes only mark the
+ * buffer dirty; dirty buffers go to disk when they are recycled or
+ * when the volume is synced.
+ *
+ * sfs_buf_get pins the buffer it returns, and a pinned buffer is
+ * never recycled, so callers can hold one across other cache use
+ * (e.g. an indirect block while sfs_balloc clears a new block, or a
+ * data block while uiomove faults and pages in from the same disk).
+ * Every sfs_buf_get must be matched by sfs_buf_release.
+ *
+ * The superblock and free block bitmap are kept in memory by struct
+ * sfs_fs and bypass the cache (sfs_readblock/sfs_writeblock); every
+ * other block goes through here, so the cache is coherent.
+ *
+ * Like the rest of SFS, the cache is protected by the vfs big lock.
+ *
+ * Buffers of file data and indirect blocks remember the file they
+ * belong to (b_owner), so fsync can write just that file's blocks.
+ *
+ * The cache can be switched off for comparison; then every read goes
+ * to disk and every write goes out as soon as the buffer is released.
+ *
+ * File blocks written for the first time are not given a disk block
+ * straight away (delayed allocation). Their buffers are keyed by
+ * (vnode, file block) instead, and blocks are chosen for them, next
+ * to each other, only when the file is synced or too many are
+ * waiting; then they become ordinary dirty buffers. In the second
+ * case they are also written out at once, in block order, so the
+ * cache doesn't fill up with dirty data (write-behind). This saves
+ * clearing the new block first and lets a file written in small
+ * pieces still end up contiguous. A delayed buffer is never recycled
+ * before it has a block.
+ *
+ * Sequential file reads also start the blocks after them into the
+ * cache without waiting (sfs_buf_readahead). Such a buffer is pinned
+ * and marked busy until its read is collected, which happens when the
+ * block is looked up or when the buffer comes up for recycling.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vfs.h>
+#include <device.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+#define SFS_NBUFS	128	/* buffers in the cache (64K) */
+#define SFS_BUFHASH	64	/* hash buckets; power of 2 */
+#define SFS_MAXINFLIGHT	32	/* read-ahead buffers waiting for disk */
+#define SFS_RAMIN	4	/* first read-ahead window, in blocks */
+#define SFS_RAMAX	32	/* largest window (16K) */
+#define SFS_MAXDELAYED	64	/* buffers waiting for a block */
+
+struct sfs_buf {
+	struct sfs_fs *b_fs;		/* volume, NULL if unused */
+	daddr_t b_block;		/* block number on the volume */
+	bool b_dirty;			/* modified since read/written */
+	unsigned b_pincount;		/* users; pinned if nonzero */
+	bool b_busy;			/* read-ahead in progress */
+	bool b_ra;			/* read ahead and not used yet */
+	struct device_req b_req;	/* the read-ahead request */
+	struct sfs_vnode *b_vn;		/* delayed: the file, else NULL */
+	uint32_t b_fileblock;		/* delayed: block within the file */
+	struct sfs_vnode *b_owner;	/* file it belongs to, if known */
+	bool b_new;			/* just given a block, not written */
+	struct sfs_buf *b_hashnext;	/* chain in sfs_bufhash */
+	struct sfs_buf *b_lrunext;	/* towards the least recently used */
+	struct sfs_buf *b_lruprev;
+	char b_data[SFS_BLOCKSIZE];
+};
+
+static struct sfs_buf sfs_bufs[SFS_NBUFS];
+static struct sfs_buf *sfs_bufhash[SFS_BUFHASH];
+static struct sfs_buf *sfs_lruhead, *sfs_lrutail;
+static bool sfs_bufinit = false;
+static bool sfs_bufenabled = true;
+static unsigned sfs_bufinflight;
+static unsigned sfs_bufndelayed;
+
+/* statistics */
+static unsigned sfs_bufhits, sfs_bufmisses, sfs_bufwrites, sfs_bufevicts;
+static unsigned sfs_raseq, sfs_rareset, sfs_rawinmax;
+static unsigned sfs_raissued, sfs_raused, sfs_rawasted, sfs_rawaits;
+static unsigned sfs_dlcreated, sfs_dlalloc, sfs_dlcontig, sfs_dldropped;
+static unsigned sfs_dlflushes;
+
+/*
+ * Put all the buffers on the LRU list, empty. Done on first use.
+ */
+static
+void
+sfs_buf_init(void)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_NBUFS; i++) {
+		sfs_bufs[i].b_fs = NULL;
+		sfs_bufs[i].b_lruprev = i > 0 ? &sfs_bufs[i-1] : NULL;
+		sfs_bufs[i].b_lrunext = i+1 < SFS_NBUFS ? &sfs_bufs[i+1] : NULL;
+	}
+	sfs_lruhead = &sfs_bufs[0];
+	sfs_lrutail = &sfs_bufs[SFS_NBUFS-1];
+	sfs_bufinit = true;
+}
+
+static
+unsigned
+sfs_buf_hash(struct sfs_fs *sfs, daddr_t block)
+{
+	return (((uintptr_t)sfs >> 6) + block) & (SFS_BUFHASH - 1);
+}
+
+static
+unsigned
+sfs_buf_dhash(struct sfs_vnode *sv, uint32_t fileblock)
+{
+	return (((uintptr_t)sv >> 6) + fileblock) & (SFS_BUFHASH - 1);
+}
+
+/* The hash chain BUF is on. */
+static
+struct sfs_buf **
+sfs_buf_chain(struct sfs_buf *buf)
+{
+	if (buf->b_vn != NULL) {
+		return &sfs_bufhash[sfs_buf_dhash(buf->b_vn, buf->b_fileblock)];
+	}
+	return &sfs_bufhash[sfs_buf_hash(buf->b_fs, buf->b_block)];
+}
+
+static
+struct sfs_buf *
+sfs_buf_lookup(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *buf;
+
+	buf = sfs_bufhash[sfs_buf_hash(sfs, block)];
+	for (; buf != NULL; buf = buf->b_hashnext) {
+		if (buf->b_fs == sfs && buf->b_vn == NULL &&
+		    buf->b_block == block) {
+			return buf;
+		}
+	}
+	return NULL;
+}
+
+/* Find the delayed buffer for FILEBLOCK of SV. */
+static
+struct sfs_buf *
+sfs_buf_dlookup(struct sfs_vnode *sv, uint32_t fileblock)
+{
+	struct sfs_buf *buf;
+
+	buf = sfs_bufhash[sfs_buf_dhash(sv, fileblock)];
+	for (; buf != NULL; buf = buf->b_hashnext) {
+		if (buf->b_vn == sv && buf->b_fileblock == fileblock) {
+			return buf;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take BUF off its hash chain. If it was delayed, it isn't any more.
+ */
+static
+void
+sfs_buf_unlink(struct sfs_buf *buf)
+{
+	struct sfs_buf **bp;
+
+	for (bp = sfs_buf_chain(buf); *bp != buf; bp = &(*bp)->b_hashnext) {
+		KASSERT(*bp != NULL);
+	}
+	*bp = buf->b_hashnext;
+	buf->b_hashnext = NULL;
+
+	if (buf->b_vn != NULL) {
+		KASSERT(buf->b_fs->sfs_ndelayed > 0 && sfs_bufndelayed > 0);
+		buf->b_fs->sfs_ndelayed--;
+		sfs_bufndelayed--;
+		buf->b_vn = NULL;
+	}
+}
+
+static
+void
+sfs_buf_unhash(struct sfs_buf *buf)
+{
+	sfs_buf_unlink(buf);
+	buf->b_fs = NULL;
+	buf->b_dirty = false;
+	if (buf->b_ra) {
+		/* read ahead for nothing */
+		buf->b_ra = false;
+		sfs_rawasted++;
+	}
+}
+
+static
+void
+sfs_buf_insert(struct sfs_buf *buf, struct sfs_fs *sfs, daddr_t block)
+{
+	unsigned h = sfs_buf_hash(sfs, block);
+
+	buf->b_fs = sfs;
+	buf->b_block = block;
+	buf->b_dirty = false;
+	buf->b_owner = NULL;
+	buf->b_new = false;
+	buf->b_hashnext = sfs_bufhash[h];
+	sfs_bufhash[h] = buf;
+}
+
+static
+void
+sfs_buf_lruremove(struct sfs_buf *buf)
+{
+	if (buf->b_lruprev != NULL) {
+		buf->b_lruprev->b_lrunext = buf->b_lrunext;
+	}
+	else {
+		sfs_lruhead = buf->b_lrunext;
+	}
+	if (buf->b_lrunext != NULL) {
+		buf->b_lrunext->b_lruprev = buf->b_lruprev;
+	}
+	else {
+		sfs_lrutail = buf->b_lruprev;
+	}
+}
+
+/* Make BUF the most recently used. */
+static
+void
+sfs_buf_touch(struct sfs_buf *buf)
+{
+	sfs_buf_lruremove(buf);
+	buf->b_lruprev = NULL;
+	buf->b_lrunext = sfs_lruhead;
+	if (sfs_lruhead != NULL) {
+		sfs_lruhead->b_lruprev = buf;
+	}
+	sfs_lruhead = buf;
+	if (sfs_lrutail == NULL) {
+		sfs_lrutail = buf;
+	}
+}
+
+/* Make BUF the first to be recycled. */
+static
+void
+sfs_buf_untouch(struct sfs_buf *buf)
+{
+	sfs_buf_lruremove(buf);
+	buf->b_lrunext = NULL;
+	buf->b_lruprev = sfs_lrutail;
+	if (sfs_lrutail != NULL) {
+		sfs_lrutail->b_lrunext = buf;
+	}
+	sfs_lrutail = buf;
+	if (sfs_lruhead == NULL) {
+		sfs_lruhead = buf;
+	}
+}
+
+/*
+ * Collect a buffer's read-ahead, waiting for it if it isn't done.
+ * If the read failed the buffer is just forgotten; whoever wants the
+ * block will read it again (with retries) through the normal path.
+ * The buffer keeps its place on the LRU list either way, so this is
+ * safe to call while walking it.
+ */
+static
+void
+sfs_buf_finish(struct sfs_buf *buf)
+{
+	int result;
+
+	KASSERT(buf->b_busy && buf->b_pincount > 0);
+
+	if (!buf->b_req.dr_complete) {
+		sfs_rawaits++;
+	}
+	result = dev_wait(buf->b_fs->sfs_device, &buf->b_req);
+	buf->b_busy = false;
+	buf->b_pincount--;
+	sfs_bufinflight--;
+	if (result) {
+		buf->b_ra = false;
+		sfs_buf_unhash(buf);
+	}
+}
+
+/*
+ * Look up a block, collecting its read-ahead first if there is one.
+ */
+static
+struct sfs_buf *
+sfs_buf_find(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *buf;
+
+	buf = sfs_buf_lookup(sfs, block);
+	if (buf != NULL && buf->b_busy) {
+		sfs_buf_finish(buf);
+		if (buf->b_fs == NULL) {
+			return NULL;
+		}
+	}
+	return buf;
+}
+
+/*
+ * Write a dirty buffer to disk.
+ */
+static
+int
+sfs_buf_writeout(struct sfs_buf *buf)
+{
+	int result;
+
+	KASSERT(buf->b_fs != NULL && buf->b_dirty && buf->b_vn == NULL);
+
+	buf->b_new = false;
+	result = sfs_writeblock(buf->b_fs, buf->b_block, buf->b_data,
+				SFS_BLOCKSIZE);
+	if (result) {
+		return result;
+	}
+	buf->b_dirty = false;
+	sfs_bufwrites++;
+	return 0;
+}
+
+/*
+ * Find the least recently used buffer that could be recycled: not
+ * pinned, not delayed, and if CLEAN is set not dirty either. NULL if
+ * there is none.
+ */
+static
+struct sfs_buf *
+sfs_buf_victim(bool clean)
+{
+	struct sfs_buf *buf;
+
+	for (buf = sfs_lrutail; buf != NULL; buf = buf->b_lruprev) {
+		if (buf->b_busy && buf->b_req.dr_complete) {
+			sfs_buf_finish(buf);
+		}
+		if (buf->b_pincount == 0 && buf->b_vn == NULL &&
+		    !(clean && buf->b_dirty)) {
+			break;
+		}
+	}
+	return buf;
+}
+
+/*
+ * Find a buffer to recycle: the least recently used unpinned one,
+ * written back first if dirty.
+ */
+static
+int
+sfs_buf_recycle(struct sfs_buf **ret)
+{
+	struct sfs_buf *buf;
+	int result;
+
+	buf = sfs_buf_victim(false);
+	if (buf == NULL) {
+		panic("sfs: all %u buffers pinned\n", SFS_NBUFS);
+	}
+
+	if (buf->b_fs != NULL) {
+		if (buf->b_dirty) {
+			result = sfs_buf_writeout(buf);
+			if (result) {
+				return result;
+			}
+		}
+		sfs_buf_unhash(buf);
+		sfs_bufevicts++;
+	}
+	*ret = buf;
+	return 0;
+}
+
+/*
+ * Get block BLOCK of SFS, pinned. If FILL is false the caller is going
+ * to overwrite the whole block, so a buffer not already cached is
+ * just zeroed instead of being read from disk.
+ */
+int
+sfs_buf_get(struct sfs_fs *sfs, daddr_t block, bool fill,
+	    struct sfs_buf **ret)
+{
+	struct sfs_buf *buf;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_bufinit) {
+		sfs_buf_init();
+	}
+
+	buf = sfs_buf_find(sfs, block);
+	if (buf != NULL) {
+		sfs_bufhits++;
+		if (buf->b_ra) {
+			buf->b_ra = false;
+			sfs_raused++;
+		}
+	}
+	else {
+		sfs_bufmisses++;
+		result = sfs_buf_recycle(&buf);
+		if (result) {
+			return result;
+		}
+		if (fill) {
+			result = sfs_readblock(sfs, block, buf->b_data,
+					       SFS_BLOCKSIZE);
+			if (result) {
+				return result;
+			}
+		}
+		else {
+			bzero(buf->b_data, SFS_BLOCKSIZE);
+		}
+		sfs_buf_insert(buf, sfs, block);
+	}
+
+	buf->b_pincount++;
+	sfs_buf_touch(buf);
+	*ret = buf;
+	return 0;
+}
+
+void *
+sfs_buf_data(struct sfs_buf *buf)
+{
+	KASSERT(buf->b_pincount > 0);
+	return buf->b_data;
+}
+
+void
+sfs_buf_markdirty(struct sfs_buf *buf)
+{
+	KASSERT(buf->b_pincount > 0);
+	buf->b_dirty = true;
+}
+
+/*
+ * Record that BUF holds a block of SV (data or indirect), for
+ * sfs_buf_syncvnode.
+ */
+void
+sfs_buf_setowner(struct sfs_buf *buf, struct sfs_vnode *sv)
+{
+	KASSERT(buf->b_pincount > 0);
+	buf->b_owner = sv;
+}
+
+/*
+ * Unpin a buffer. With the cache off, write it out now and forget it;
+ * if the write fails it stays dirty and is retried on sync.
+ */
+void
+sfs_buf_release(struct sfs_buf *buf)
+{
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(buf->b_pincount > 0);
+
+	buf->b_pincount--;
+	if (sfs_bufenabled || buf->b_pincount > 0) {
+		return;
+	}
+	if (buf->b_dirty) {
+		result = sfs_buf_writeout(buf);
+		if (result) {
+			kprintf("sfs: %s: block %u write error: %s\n",
+				buf->b_fs->sfs_sb.sb_volname, buf->b_block,
+				strerror(result));
+			return;
+		}
+	}
+	sfs_buf_unhash(buf);
+	sfs_buf_untouch(buf);
+}
+
+/*
+ * Copy a whole block in or out through the cache.
+ */
+int
+sfs_buf_read(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	struct sfs_buf *buf;
+	int result;
+
+	KASSERT(len == SFS_BLOCKSIZE);
+
+	result = sfs_buf_get(sfs, block, true, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(data, buf->b_data, len);
+	sfs_buf_release(buf);
+	return 0;
+}
+
+int
+sfs_buf_write(struct sfs_fs *sfs, daddr_t block, const void *data,
+	      size_t len)
+{
+	struct sfs_buf *buf;
+	int result;
+
+	KASSERT(len == SFS_BLOCKSIZE);
+
+	result = sfs_buf_get(sfs, block, false, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(buf->b_data, data, len);
+	buf->b_dirty = true;
+	sfs_buf_release(buf);
+	return 0;
+}
+
+/*
+ * Check whether a block is in the cache, for callers that want to go
+ * around it.
+ */
+bool
+sfs_buf_incache(struct sfs_fs *sfs, daddr_t block)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+
+	return sfs_bufinit && sfs_buf_lookup(sfs, block) != NULL;
+}
+
+/*
+ * A block has been freed, or is about to be overwritten on disk
+ * directly; drop its buffer without writing it.
+ */
+void
+sfs_buf_invalidate(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *buf;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_bufinit) {
+		return;
+	}
+	buf = sfs_buf_find(sfs, block);
+	if (buf != NULL) {
+		KASSERT(buf->b_pincount == 0);
+		sfs_buf_unhash(buf);
+		sfs_buf_untouch(buf);
+	}
+}
+
+/*
+ * Write out the dirty buffers of SFS, in block order so the disk head
+ * sweeps once: all of them if SV is NULL, else only the blocks of SV
+ * and its inode. If NEWONLY is set, only buffers just given blocks
+ * by sfs_buf_flushdelayed. Returns the first error but still tries
+ * the rest.
+ */
+static
+int
+sfs_buf_syncsome(struct sfs_fs *sfs, struct sfs_vnode *sv, bool newonly)
+{
+	struct sfs_buf *buf, *next;
+	unsigned i;
+	daddr_t last;
+	int result, firsterr = 0;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_bufinit) {
+		return 0;
+	}
+
+	last = 0;
+	while (1) {
+		/* the dirty buffer with the lowest block at or past LAST */
+		next = NULL;
+		for (i=0; i<SFS_NBUFS; i++) {
+			buf = &sfs_bufs[i];
+			if (buf->b_fs == sfs && buf->b_dirty &&
+			    buf->b_vn == NULL && buf->b_block >= last &&
+			    (sv == NULL || buf->b_owner == sv ||
+			     buf->b_block == sv->sv_ino) &&
+			    (!newonly || buf->b_new) &&
+			    (next == NULL || buf->b_block < next->b_block)) {
+				next = buf;
+			}
+		}
+		if (next == NULL) {
+			break;
+		}
+		last = next->b_block + 1;
+		result = sfs_buf_writeout(next);
+		if (result && firsterr == 0) {
+			firsterr = result;
+		}
+	}
+	return firsterr;
+}
+
+/*
+ * Write out all dirty buffers of SFS.
+ */
+int
+sfs_buf_sync(struct sfs_fs *sfs)
+{
+	return sfs_buf_syncsome(sfs, NULL, false);
+}
+
+/*
+ * Write out the dirty buffers of one file, for fsync. Delayed buffers
+ * must have been given blocks (sfs_buf_flushdelayed) first.
+ */
+int
+sfs_buf_syncvnode(struct sfs_vnode *sv)
+{
+	return sfs_buf_syncsome(sv->sv_absvn.vn_fs->fs_data, sv, false);
+}
+
+/*
+ * SV is going away; forget it owns any buffers, so a new vnode at the
+ * same address doesn't pick them up.
+ */
+void
+sfs_buf_disown(struct sfs_vnode *sv)
+{
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_bufinit) {
+		return;
+	}
+	for (i=0; i<SFS_NBUFS; i++) {
+		if (sfs_bufs[i].b_owner == sv) {
+			sfs_bufs[i].b_owner = NULL;
+		}
+	}
+}
+
+/*
+ * Forget every buffer of SFS, which is being unmounted and has been
+ * synced. Read-ahead still in flight is waited for, so this must be
+ * done before the volume lets go of its device.
+ */
+void
+sfs_buf_drop(struct sfs_fs *sfs)
+{
+	struct sfs_buf *buf;
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_bufinit) {
+		return;
+	}
+	for (i=0; i<SFS_NBUFS; i++) {
+		buf = &sfs_bufs[i];
+		if (buf->b_fs == sfs && buf->b_busy) {
+			sfs_buf_finish(buf);
+		}
+		if (buf->b_fs == sfs) {
+			KASSERT(buf->b_pincount == 0);
+			KASSERT(!buf->b_dirty);
+			sfs_buf_unhash(buf);
+			sfs_buf_untouch(buf);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Delayed allocation
+
+/*
+ * Check whether new blocks of SFS can be delayed. Only while the
+ * cache is on, and only while there is certainly room on disk for
+ * all the delayed blocks when they are allocated, counting an
+ * indirect block for each, so the write can still fail with ENOSPC
+ * now rather than at sync time. sfs_balloc keeps that room free for
+ * them afterwards.
+ */
+bool
+sfs_buf_candelay(struct sfs_fs *sfs)
+{
+	return sfs_bufenabled &&
+		sfs->sfs_nfree >= 2 * (sfs->sfs_ndelayed + 1);
+}
+
+/*
+ * Give all delayed buffers of every file their blocks.
+ */
+static
+int
+sfs_buf_flushall(void)
+{
+	struct sfs_buf *buf;
+	unsigned i;
+	int result;
+
+	for (i=0; i<SFS_NBUFS; i++) {
+		buf = &sfs_bufs[i];
+		if (buf->b_vn != NULL) {
+			result = sfs_buf_flushdelayed(buf->b_vn);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Too many buffers are waiting for blocks: give them all blocks and
+ * write them out, each volume in block order.
+ */
+static
+int
+sfs_buf_writebehind(void)
+{
+	struct sfs_fs *sfs;
+	unsigned i;
+	int result;
+
+	sfs_dlflushes++;
+	result = sfs_buf_flushall();
+	if (result) {
+		return result;
+	}
+	while (1) {
+		/* a volume with buffers still to write */
+		sfs = NULL;
+		for (i=0; i<SFS_NBUFS; i++) {
+			if (sfs_bufs[i].b_fs != NULL && sfs_bufs[i].b_new &&
+			    sfs_bufs[i].b_dirty) {
+				sfs = sfs_bufs[i].b_fs;
+				break;
+			}
+		}
+		if (sfs == NULL) {
+			break;
+		}
+		/* each one is tried once; a failure stays dirty */
+		result = sfs_buf_syncsome(sfs, NULL, true);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Get the delayed buffer for FILEBLOCK of SV, pinned. If there isn't
+ * one, make a zeroed one if CREATE is set (the caller has checked
+ * sfs_buf_candelay) or else hand back NULL.
+ */
+int
+sfs_buf_getdelayed(struct sfs_vnode *sv, uint32_t fileblock, bool create,
+		   struct sfs_buf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	unsigned h;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_bufinit) {
+		sfs_buf_init();
+	}
+
+	buf = sfs_buf_dlookup(sv, fileblock);
+	if (buf == NULL) {
+		if (!create) {
+			*ret = NULL;
+			return 0;
+		}
+		if (sfs_bufndelayed >= SFS_MAXDELAYED) {
+			result = sfs_buf_writebehind();
+			if (result) {
+				return result;
+			}
+		}
+		result = sfs_buf_recycle(&buf);
+		if (result) {
+			return result;
+		}
+		bzero(buf->b_data, SFS_BLOCKSIZE);
+		buf->b_fs = sfs;
+		buf->b_block = 0;
+		buf->b_dirty = true;
+		buf->b_vn = sv;
+		buf->b_fileblock = fileblock;
+		buf->b_owner = sv;
+		h = sfs_buf_dhash(sv, fileblock);
+		buf->b_hashnext = sfs_bufhash[h];
+		sfs_bufhash[h] = buf;
+		sfs->sfs_ndelayed++;
+		sfs_bufndelayed++;
+		sfs_dlcreated++;
+	}
+
+	buf->b_pincount++;
+	sfs_buf_touch(buf);
+	*ret = buf;
+	return 0;
+}
+
+/*
+ * Allocate disk blocks for all the delayed buffers of SV, in file
+ * block order, each one right after the block before it in the file
+ * if that's free. The buffers become ordinary dirty buffers and go
+ * to disk with the next sync or when recycled.
+ */
+int
+sfs_buf_flushdelayed(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf, *next;
+	daddr_t goal, block;
+	unsigned i;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_bufinit || sfs->sfs_ndelayed == 0) {
+		return 0;
+	}
+
+	goal = 0;
+	while (1) {
+		/* the delayed buffer of SV with the lowest file block */
+		next = NULL;
+		for (i=0; i<SFS_NBUFS; i++) {
+			buf = &sfs_bufs[i];
+			if (buf->b_vn == sv &&
+			    (next == NULL ||
+			     buf->b_fileblock < next->b_fileblock)) {
+				next = buf;
+			}
+		}
+		if (next == NULL) {
+			break;
+		}
+
+		/* Follow on from the block before, if it's on disk. */
+		if (next->b_fileblock > 0) {
+			result = sfs_bmap(sv, next->b_fileblock - 1, false,
+					  &block);
+			if (result == 0 && block != 0) {
+				goal = block + 1;
+			}
+		}
+
+		/* Keep it while bmap uses the cache. */
+		next->b_pincount++;
+		result = sfs_bmap_delayed(sv, next->b_fileblock, goal, &block);
+		next->b_pincount--;
+		if (result) {
+			return result;
+		}
+		if (block == goal) {
+			sfs_dlcontig++;
+		}
+		sfs_dlalloc++;
+
+		/* Rehash it under its disk block. */
+		sfs_buf_unlink(next);
+		sfs_buf_insert(next, sfs, block);
+		next->b_dirty = true;
+		next->b_owner = sv;
+		next->b_new = true;
+
+		goal = block + 1;
+	}
+	return 0;
+}
+
+/*
+ * Throw away the delayed buffers of SV from file block FROMBLOCK on,
+ * which are past the end of a truncated or erased file.
+ */
+void
+sfs_buf_dropdelayed(struct sfs_vnode *sv, uint32_t fromblock)
+{
+	struct sfs_buf *buf;
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_bufinit) {
+		return;
+	}
+	for (i=0; i<SFS_NBUFS; i++) {
+		buf = &sfs_bufs[i];
+		if (buf->b_vn == sv && buf->b_fileblock >= fromblock) {
+			KASSERT(buf->b_pincount == 0);
+			sfs_buf_unhash(buf);
+			sfs_buf_untouch(buf);
+			sfs_dldropped++;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Read-ahead
+
+/*
+ * Start reading BLOCK into the cache, unless it's there already, and
+ * return without waiting. This is only a hint, so it quietly does
+ * nothing if the cache is off, too many reads are outstanding, or
+ * there is no clean buffer to spare (it never waits to write one).
+ */
+static
+void
+sfs_buf_prefetch(struct sfs_fs *sfs, daddr_t block)
+{
+	struct device *dev = sfs->sfs_device;
+	struct sfs_buf *buf;
+	int result;
+
+	if (!sfs_bufenabled || sfs_bufinflight >= SFS_MAXINFLIGHT) {
+		return;
+	}
+	if (sfs_buf_lookup(sfs, block) != NULL) {
+		return;
+	}
+	buf = sfs_buf_victim(true);
+	if (buf == NULL) {
+		return;
+	}
+	if (buf->b_fs != NULL) {
+		sfs_buf_unhash(buf);
+		sfs_bufevicts++;
+	}
+
+	KASSERT(SFS_BLOCKSIZE % dev->d_blocksize == 0);
+	buf->b_req.dr_block = block * (SFS_BLOCKSIZE / dev->d_blocksize);
+	buf->b_req.dr_nblocks = SFS_BLOCKSIZE / dev->d_blocksize;
+	buf->b_req.dr_data = buf->b_data;
+	buf->b_req.dr_write = false;
+	result = dev_submit(dev, &buf->b_req);
+	if (result) {
+		return;
+	}
+
+	sfs_buf_insert(buf, sfs, block);
+	buf->b_busy = true;
+	buf->b_ra = true;
+	buf->b_pincount++;
+	sfs_buf_touch(buf);
+	sfs_bufinflight++;
+	sfs_raissued++;
+}
+
+/*
+ * Called after a read of SV from STARTPOS to ENDPOS. A read that
+ * starts where the last one ended is sequential and doubles the
+ * file's window, from SFS_RAMIN up to SFS_RAMAX blocks; the blocks
+ * in the window past ENDPOS are then prefetched. Any other read
+ * closes the window again.
+ *
+ * The state is per vnode, since open files are not visible down
+ * here; two streams through one file will mostly turn it off.
+ */
+void
+sfs_buf_readahead(struct sfs_vnode *sv, off_t startpos, off_t endpos)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t fileblock, lastblock, nfileblocks;
+	daddr_t diskblock;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_bufinit) {
+		sfs_buf_init();
+	}
+
+	if (startpos != sv->sv_rapos) {
+		if (sv->sv_rawin > 0) {
+			sfs_rareset++;
+		}
+		sv->sv_rapos = endpos;
+		sv->sv_rawin = 0;
+		sv->sv_raend = 0;
+		return;
+	}
+	sv->sv_rapos = endpos;
+
+	sfs_raseq++;
+	sv->sv_rawin = sv->sv_rawin == 0 ? SFS_RAMIN : sv->sv_rawin * 2;
+	if (sv->sv_rawin > SFS_RAMAX) {
+		sv->sv_rawin = SFS_RAMAX;
+	}
+	if (sv->sv_rawin > sfs_rawinmax) {
+		sfs_rawinmax = sv->sv_rawin;
+	}
+
+	fileblock = endpos / SFS_BLOCKSIZE;
+	lastblock = fileblock + sv->sv_rawin;
+	nfileblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	if (lastblock > nfileblocks) {
+		lastblock = nfileblocks;
+	}
+	if (fileblock < sv->sv_raend) {
+		fileblock = sv->sv_raend;
+	}
+
+	for (; fileblock < lastblock; fileblock++) {
+		if (sfs_bmap(sv, fileblock, false, &diskblock)) {
+			break;
+		}
+		if (diskblock != 0) {
+			sfs_buf_prefetch(sfs, diskblock);
+		}
+	}
+	sv->sv_raend = fileblock;
+}
+
+/*
+ * Switch the cache on or off. Switching it off writes out and drops
+ * every unpinned buffer. The statistics start over either way.
+ */
+void
+sfs_bufcache_set(bool on)
+{
+	struct sfs_buf *buf;
+	unsigned i;
+	int result;
+
+	vfs_biglock_acquire();
+	if (!sfs_bufinit) {
+		sfs_buf_init();
+	}
+	if (!on) {
+		/* delayed buffers can't just be written; allocate first */
+		result = sfs_buf_flushall();
+		if (result) {
+			kprintf("sfs: buffer cache: %s\n", strerror(result));
+			vfs_biglock_release();
+			return;
+		}
+	}
+	sfs_bufenabled = on;
+	if (!on) {
+		for (i=0; i<SFS_NBUFS; i++) {
+			buf = &sfs_bufs[i];
+			if (buf->b_fs == NULL || buf->b_pincount > 0) {
+				continue;
+			}
+			if (buf->b_dirty) {
+				result = sfs_buf_writeout(buf);
+				if (result) {
+					continue;
+				}
+			}
+			sfs_buf_unhash(buf);
+			sfs_buf_untouch(buf);
+		}
+	}
+	sfs_bufhits = sfs_bufmisses = sfs_bufwrites = sfs_bufevicts = 0;
+	sfs_raseq = sfs_rareset = sfs_rawinmax = 0;
+	sfs_raissued = sfs_raused = sfs_rawasted = sfs_rawaits = 0;
+	sfs_dlcreated = sfs_dlalloc = sfs_dlcontig = sfs_dldropped = 0;
+	sfs_dlflushes = 0;
+	vfs_biglock_release();
+}
+
+bool
+sfs_bufcache_get(void)
+{
+	return sfs_bufenabled;
+}
+
+void
+sfs_bufcache_printstats(void)
+{
+	unsigned lookups, permille;
+
+	vfs_biglock_acquire();
+	lookups = sfs_bufhits + sfs_bufmisses;
+	permille = lookups ? (uint64_t)sfs_bufhits * 1000 / lookups : 0;
+	kprintf("SFS buffer cache: %s, %u buffers\n",
+		sfs_bufenabled ? "on" : "off", SFS_NBUFS);
+	kprintf("    %u hits, %u misses (hit rate %u.%u%%), "
+		"%u writes, %u evictions\n", sfs_bufhits, sfs_bufmisses,
+		permille / 10, permille % 10, sfs_bufwrites, sfs_bufevicts);
+	kprintf("    read-ahead: %u sequential reads, %u window resets, "
+		"largest window %u blocks\n", sfs_raseq, sfs_rareset,
+		sfs_rawinmax);
+	kprintf("    read-ahead: %u blocks issued, %u used, %u wasted, "
+		"%u waited for, %u in flight\n", sfs_raissued, sfs_raused,
+		sfs_rawasted, sfs_rawaits, sfs_bufinflight);
+	kprintf("    delayed allocation: %u blocks delayed, %u allocated "
+		"(%u contiguous), %u never needed, %u waiting, "
+		"%u write-behind flushes\n", sfs_dlcreated, sfs_dlalloc,
+		sfs_dlcontig, sfs_dldropped, sfs_bufndelayed, sfs_dlflushes);
+	vfs_biglock_release();
+}
@@ -215,6 +215,13 @@ sfs_sync(struct fs *fs)
 		return result;
 	}
 
+	/* Write out the dirty buffers, including the inodes just synced. */
+	result = sfs_buf_sync(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* If the free block map needs to be written, write it. */
 	result = sfs_sync_freemap(sfs);
 	if (result) {
@@ -290,6 +297,12 @@ sfs_unmount(struct fs *fs)
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/*
+	 * Forget our buffers. This waits for any read-ahead still
+	 * in flight, so it needs the device.
+	 */
+	sfs_buf_drop(sfs);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -359,6 +372,8 @@ sfs_fs_create(void)
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_nfree = 0;
+	sfs->sfs_ndelayed = 0;
 
 	return sfs;
 
@@ -387,6 +402,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
 	struct sfs_fs *sfs;
+	uint32_t i;
 
 	vfs_biglock_acquire();
 
@@ -463,6 +479,11 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		vfs_biglock_release();
 		return result;
 	}
+	for (i=0; i<sfs->sfs_sb.sb_nblocks; i++) {
+		if (!bitmap_isset(sfs->sfs_freemap, i)) {
+			sfs->sfs_nfree++;
+		}
+	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
@@ -50,8 +50,8 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	int result;
 
 	if (sv->sv_dirty) {
-		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
-					sizeof(sv->sv_i));
+		result = sfs_buf_write(sfs, sv->sv_ino, &sv->sv_i,
+				       sizeof(sv->sv_i));
 		if (result) {
 			return result;
 		}
@@ -102,6 +102,20 @@ sfs_reclaim(struct vnode *v)
 		}
 	}
 
+	/*
+	 * Data not given disk blocks yet needs them now. The room is
+	 * reserved, so only an I/O error stops this; then the data is
+	 * lost, and no buffer may be left pointing at this vnode.
+	 */
+	result = sfs_buf_flushdelayed(sv);
+	if (result) {
+		kprintf("sfs: %s: file %u: unwritten data lost: %s\n",
+			sfs->sfs_sb.sb_volname, sv->sv_ino, strerror(result));
+		sfs_buf_dropdelayed(sv, 0);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
@@ -131,6 +145,9 @@ sfs_reclaim(struct vnode *v)
 	}
 	vnodearray_remove(sfs->sfs_vnodes, ix);
 
+	/* Its blocks stay cached, but no longer as this vnode's */
+	sfs_buf_disown(sv);
+
 	vnode_cleanup(&sv->sv_absvn);
 
 	vfs_biglock_release();
@@ -196,7 +213,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	}
 
 	/* Read the block the inode is in */
-	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
+	result = sfs_buf_read(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
 		kfree(sv);
 		return result;
@@ -241,6 +258,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	sv->sv_rapos = 0;
+	sv->sv_rawin = 0;
+	sv->sv_raend = 0;
 
 	/* Add it to our table */
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
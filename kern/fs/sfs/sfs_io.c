@@ -50,6 +50,10 @@
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
  * except sfs_device.
+ *
+ * These go straight to the disk. Only the superblock and
+ * freemap are done this way; all other blocks go through
+ * the buffer cache (sfs_buf.c), which uses these itself.
  */
 
 /*
@@ -135,6 +139,51 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 //
 // File-level I/O
 
+/*
+ * Get the buffer for block FILEBLOCK of a file, pinned; FILL is as
+ * for sfs_buf_get. A hole gives NULL when reading. When writing, a
+ * hole is filled with a delayed buffer if the cache can take one, so
+ * the disk block is chosen later (see sfs_buf.c); otherwise a block
+ * is allocated now.
+ */
+static
+int
+sfs_getfileblock(struct sfs_vnode *sv, uint32_t fileblock, bool write,
+		 bool fill, struct sfs_buf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t diskblock;
+	int result;
+
+	/* Get the disk block number */
+	result = sfs_bmap(sv, fileblock, false, &diskblock);
+	if (result) {
+		return result;
+	}
+
+	if (diskblock == 0) {
+		/* It may have been written and not allocated yet. */
+		result = sfs_buf_getdelayed(sv, fileblock,
+					    write && sfs_buf_candelay(sfs), ret);
+		if (result || *ret != NULL || !write) {
+			return result;
+		}
+
+		/* Allocate missing blocks if and only if we're writing */
+		result = sfs_bmap(sv, fileblock, true, &diskblock);
+		if (result) {
+			return result;
+		}
+	}
+
+	result = sfs_buf_get(sfs, diskblock, fill, ret);
+	if (result) {
+		return result;
+	}
+	sfs_buf_setowner(*ret, sv);
+	return 0;
+}
+
 /*
  * Do I/O to a block of a file that doesn't cover the whole block.  We
  * need to read in the original block first, even if we're writing, so
@@ -150,74 +199,51 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
-	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t diskblock;
+	struct sfs_buf *buf;
 	uint32_t fileblock;
 	int result;
 
-	/* Allocate missing blocks if and only if we're writing */
-	bool doalloc = (uio->uio_rw==UIO_WRITE);
-
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
+	/* The buffer cache needs the big lock */
 	KASSERT(vfs_biglock_do_i_hold());
 
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
-	/* Get the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	/*
+	 * Get the block. It stays pinned while we copy, in case
+	 * uiomove faults and the pager needs the cache.
+	 */
+	result = sfs_getfileblock(sv, fileblock, uio->uio_rw == UIO_WRITE,
+				  true, &buf);
 	if (result) {
 		return result;
 	}
 
-	if (diskblock == 0) {
+	if (buf == NULL) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
 	 * Now perform the requested operation into/out of the buffer.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
-	if (result) {
-		return result;
-	}
+	result = uiomove((char *)sfs_buf_data(buf) + skipstart, len, uio);
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * If it was a write, the block needs writing back.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		sfs_buf_markdirty(buf);
 	}
+	sfs_buf_release(buf);
 
-	return 0;
+	return result;
 }
 
 /*
@@ -227,60 +253,149 @@ static
 int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
-	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t diskblock;
+	struct sfs_buf *buf;
 	uint32_t fileblock;
 	int result;
-	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
-	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	/*
+	 * Go through the buffer cache. When writing, the whole block
+	 * is replaced, so there is no need to read it first.
+	 */
+	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
+	result = sfs_getfileblock(sv, fileblock, uio->uio_rw == UIO_WRITE,
+				  uio->uio_rw == UIO_READ, &buf);
 	if (result) {
 		return result;
 	}
 
-	if (diskblock == 0) {
+	if (buf == NULL) {
 		/*
 		 * No block - fill with zeros.
 		 *
-		 * We must be reading, or sfs_bmap would have
-		 * allocated a block for us.
+		 * We must be reading, or sfs_getfileblock would have
+		 * found or made a block for us.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
-	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	result = uiomove(sfs_buf_data(buf), SFS_BLOCKSIZE, uio);
 
-	/*
-	 * Temporarily set the residue to be one block size.
-	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
+	if (uio->uio_rw == UIO_WRITE) {
+		sfs_buf_markdirty(buf);
+	}
+	sfs_buf_release(buf);
 
-	result = sfs_rwblock(sfs, uio);
+	return result;
+}
 
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+/*
+ * Runs of whole blocks that are contiguous on disk are moved in one
+ * device request through a bounce buffer instead of block by block
+ * through the cache. The bounce buffer keeps the device from ever
+ * copying to user memory (a fault there could need the same disk),
+ * and is marked busy while in use since such a fault can come back
+ * here; then we just use the block path.
+ */
+#define SFS_MAXRUN 64	/* blocks per request (32K) */
+
+static char *sfs_runbuf;
+static bool sfs_runbusy;
+
+/*
+ * Find how many of the next NBLOCKS whole blocks at the uio offset
+ * can be done as one run: consecutive on disk, starting at
+ * *DISKBLOCK. Reads must stop at blocks in the cache, which may be
+ * newer than the disk. Writes replace whole blocks, so cached copies
+ * don't stop them; sfs_runio drops those once the new data is on
+ * disk. Both stop at holes, which may have delayed data (reads) or be
+ * about to get some (writes). A run of 0 or 1 means use the block
+ * path.
+ */
+static
+int
+sfs_findrun(struct sfs_vnode *sv, struct uio *uio, uint32_t nblocks,
+	    daddr_t *diskblock, uint32_t *ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	bool iswrite = (uio->uio_rw == UIO_WRITE);
+	uint32_t fileblock, n;
+	daddr_t block, first = 0;
+	int result;
+
+	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+	for (n=0; n<nblocks && n<SFS_MAXRUN; n++) {
+		result = sfs_bmap(sv, fileblock + n, false, &block);
+		if (result) {
+			if (n > 0) {
+				/* do what we have; it will come up again */
+				break;
+			}
+			return result;
+		}
+		if (block == 0 || (n > 0 && block != first + n)) {
+			break;
+		}
+		if (!iswrite && sfs_buf_incache(sfs, block)) {
+			break;
+		}
+		if (n == 0) {
+			first = block;
+		}
+	}
+
+	*diskblock = first;
+	*ret = n;
+	return 0;
+}
+
+/*
+ * Do a run found by sfs_findrun in one device request.
+ */
+static
+int
+sfs_runio(struct sfs_vnode *sv, struct uio *uio, daddr_t diskblock,
+	  uint32_t run)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct iovec iov;
+	struct uio ku;
+	size_t len = run * SFS_BLOCKSIZE;
+	uint32_t i;
+	int result;
+
+	KASSERT(!sfs_runbusy && sfs_runbuf != NULL);
+	KASSERT(run <= SFS_MAXRUN && len <= uio->uio_resid);
+
+	sfs_runbusy = true;
+	uio_kinit(&iov, &ku, sfs_runbuf, len,
+		  ((off_t)diskblock) * SFS_BLOCKSIZE, uio->uio_rw);
+	if (uio->uio_rw == UIO_WRITE) {
+		result = uiomove(sfs_runbuf, len, uio);
+		if (result == 0) {
+			result = sfs_rwblock(sfs, &ku);
+		}
+		if (result == 0) {
+			/*
+			 * Cached copies are stale now. Not before: they
+			 * may be dirty and must survive a failed uiomove,
+			 * and a fault in uiomove may read them back in.
+			 */
+			for (i=0; i<run; i++) {
+				sfs_buf_invalidate(sfs, diskblock + i);
+			}
+		}
+	}
+	else {
+		result = sfs_rwblock(sfs, &ku);
+		if (result == 0) {
+			result = uiomove(sfs_runbuf, len, uio);
+		}
+	}
+	sfs_runbusy = false;
 
 	return result;
 }
@@ -292,11 +407,14 @@ int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
+	uint32_t nblocks, run;
+	daddr_t diskblock;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	off_t origoffset;
 
 	origresid = uio->uio_resid;
+	origoffset = uio->uio_offset;
 
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
@@ -348,15 +466,35 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Now we should be block-aligned. Do the remaining whole blocks.
+	 * Now we should be block-aligned. Do the remaining whole blocks,
+	 * in runs where they are contiguous on disk.
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	if (nblocks > 1 && sfs_runbuf == NULL) {
+		/* if this fails we just use the block path */
+		sfs_runbuf = kmalloc(SFS_MAXRUN * SFS_BLOCKSIZE);
+	}
+	while (nblocks > 0) {
+		run = 0;
+		if (nblocks > 1 && sfs_runbuf != NULL && !sfs_runbusy) {
+			result = sfs_findrun(sv, uio, nblocks,
+					     &diskblock, &run);
+			if (result) {
+				goto out;
+			}
+		}
+		if (run > 1) {
+			result = sfs_runio(sv, uio, diskblock, run);
+		}
+		else {
+			run = 1;
+			result = sfs_blockio(sv, uio);
+		}
 		if (result) {
 			goto out;
 		}
+		nblocks -= run;
 	}
 
 	/*
@@ -373,6 +511,11 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 
  out:
 
+	/* If reading, keep the blocks after this coming */
+	if (result == 0 && uio->uio_rw == UIO_READ) {
+		sfs_buf_readahead(sv, origoffset, uio->uio_offset);
+	}
+
 	/* If writing and we did anything, adjust file length */
 	if (uio->uio_resid != origresid &&
 	    uio->uio_rw == UIO_WRITE &&
@@ -407,6 +550,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	char *metaiobuf;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,16 +559,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
+	/* The buffer cache needs the big lock */
 	KASSERT(vfs_biglock_do_i_hold());
 
 	/* Figure out which block of the vnode (directory, whatever) this is */
@@ -446,26 +582,24 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = sfs_buf_get(sfs, diskblock, true, &buf);
 	if (result) {
 		return result;
 	}
+	sfs_buf_setowner(buf, sv);
+	metaiobuf = sfs_buf_data(buf);
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
 		memcpy(data, metaiobuf + blockoffset, len);
+		sfs_buf_release(buf);
 	}
 	else {
-		/* Update the selected region */
+		/* Update the selected region; it goes to disk later */
 		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		sfs_buf_markdirty(buf);
+		sfs_buf_release(buf);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
@@ -225,21 +225,49 @@ sfs_fsync(struct vnode *v)
 	int result;
 
 	vfs_biglock_acquire();
-	result = sfs_sync_inode(sv);
+	/* give delayed blocks their disk blocks, updating the inode */
+	result = sfs_buf_flushdelayed(sv);
+	if (result == 0) {
+		result = sfs_sync_inode(sv);
+	}
+	if (result == 0) {
+		/* write our data and indirect blocks and the inode */
+		result = sfs_buf_syncvnode(sv);
+	}
 	vfs_biglock_release();
 
 	return result;
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). The mapping is paged through sfs_read and
+ * sfs_write, so all we do is report how much of it the file covers.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v, off_t offset, size_t len, size_t *backed)
 {
-	(void)v;
-	return ENOSYS;
+	struct sfs_vnode *sv = v->vn_data;
+	off_t size;
+
+	if (offset < 0) {
+		return EINVAL;
+	}
+
+	vfs_biglock_acquire();
+	size = sv->sv_i.sfi_size;
+	vfs_biglock_release();
+
+	if (size <= offset) {
+		*backed = 0;
+	}
+	else if (size - offset < (off_t)len) {
+		*backed = size - offset;
+	}
+	else {
+		*backed = len;
+	}
+	return 0;
 }
 
 /*
@@ -44,12 +44,40 @@ extern const struct vnode_ops sfs_dirops;
 
 /* Functions in sfs_balloc.c */
 int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_balloc_delayed(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_balloc_near(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
+/* Functions in sfs_buf.c */
+struct sfs_buf;
+int sfs_buf_get(struct sfs_fs *sfs, daddr_t block, bool fill,
+		struct sfs_buf **ret);
+void *sfs_buf_data(struct sfs_buf *buf);
+void sfs_buf_markdirty(struct sfs_buf *buf);
+void sfs_buf_setowner(struct sfs_buf *buf, struct sfs_vnode *sv);
+void sfs_buf_release(struct sfs_buf *buf);
+int sfs_buf_read(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
+int sfs_buf_write(struct sfs_fs *sfs, daddr_t block, const void *data,
+		size_t len);
+bool sfs_buf_incache(struct sfs_fs *sfs, daddr_t block);
+void sfs_buf_invalidate(struct sfs_fs *sfs, daddr_t block);
+int sfs_buf_sync(struct sfs_fs *sfs);
+int sfs_buf_syncvnode(struct sfs_vnode *sv);
+void sfs_buf_disown(struct sfs_vnode *sv);
+void sfs_buf_drop(struct sfs_fs *sfs);
+void sfs_buf_readahead(struct sfs_vnode *sv, off_t startpos, off_t endpos);
+bool sfs_buf_candelay(struct sfs_fs *sfs);
+int sfs_buf_getdelayed(struct sfs_vnode *sv, uint32_t fileblock, bool create,
+		struct sfs_buf **ret);
+int sfs_buf_flushdelayed(struct sfs_vnode *sv);
+void sfs_buf_dropdelayed(struct sfs_vnode *sv, uint32_t fromblock);
+
 /* Functions in sfs_bmap.c */
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
+int sfs_bmap_delayed(struct sfs_vnode *sv, uint32_t fileblock, daddr_t goal,
+		daddr_t *diskblock);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
 
 /* Functions in sfs_dir.c */
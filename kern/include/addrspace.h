@@ -36,9 +36,11 @@
 
 
 #include <vm.h>
+#include <platform/maxcpus.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
 
 
 /*
@@ -52,14 +54,59 @@ struct vnode;
 #define CURR_PERMISSION(permission) ((permission) & 0xF)      /* getting current permission from region */
 #define REGION_PERMISSION(permission) ((((permission)<<4) | (permission)) & 0xFF) /* generate permissions for region */
 
+/*
+ * A region backed by an executable records where its file contents
+ * live; vm_fault reads each page in from there on first touch. The
+ * file part starts at file_vaddr, which need not be page aligned,
+ * and anything past file_size is zero-filled.
+ *
+ * Regions made by mmap are also file backed, and in addition have
+ * their modified pages written back to the file on munmap, fsync and
+ * exit.
+ */
 typedef struct region {
     vaddr_t base;
     size_t size;
     size_t npages;
     uint32_t permission; 
-    struct region *next;
+    struct vnode *vnode;        /* backing file, or NULL if anonymous */
+    off_t file_offset;
+    vaddr_t file_vaddr;
+    size_t file_size;
+    bool mapped;                /* created by mmap */
 }region, *region_ptr;
 
+/*
+ * The stack starts as a single page below USERSTACK and vm_fault
+ * grows it down to cover any fault within VM_STACK_MAX_PAGES of the
+ * top. That much address space is kept for it: the heap and mmap
+ * stop a further VM_STACK_GUARD_PAGES below, so an overflowing stack
+ * faults in the gap instead of running into them.
+ */
+#define VM_STACK_MAX_PAGES   2048  /* 8 MB */
+#define VM_STACK_GUARD_PAGES 16
+#define VM_STACK_FLOOR (USERSTACK - VM_STACK_MAX_PAGES * PAGE_SIZE)
+
+/*
+ * Software TLB: a direct-mapped cache of an address space's recent
+ * translations, page -> PTE, that lets vm_fault reload a resident
+ * page without walking the page table or taking as_lock. PTEs never
+ * move while mapped, so the cache holds pointers to them; it is
+ * flushed whenever the hardware TLB entries of the address space
+ * are (as_asid_renew), which covers every unmap.
+ */
+#define VM_STLB_SIZE 64
+#define VM_STLB_SLOT(vaddr) (((vaddr) >> 12) % VM_STLB_SIZE)
+
+struct stlb_entry {
+    vaddr_t se_vaddr;
+    page_table_entry *se_pte;   /* NULL if the slot is empty */
+};
+
+/* mmap protection bits, as in userland <unistd.h> */
+#define PROT_READ  1
+#define PROT_WRITE 2
+
 struct addrspace {
 #if OPT_DUMBVM
 
@@ -77,7 +124,43 @@ struct addrspace {
 #else
         /* Put stuff here for your VM system */   
         l1_page_table pagetable;
-        region_ptr region_start;
+
+        /*
+         * Held by faults and by changes to the regions or the page
+         * table; the PTEs themselves are under the pager's spinlock
+         * (see vm.c).
+         */
+        struct lock *as_lock;
+
+        /*
+         * Regions sorted by base address, so a fault can binary
+         * search them. last_region remembers the most recent hit;
+         * consecutive faults nearly always land in the same region.
+         */
+        region_ptr *regions;
+        unsigned nregions;
+        unsigned maxregions;
+        region_ptr last_region;
+
+        /*
+         * The heap is an ordinary anonymous region just above the
+         * loaded segments; heap_brk is the (unaligned) break that
+         * sbrk moves, and the region covers it rounded up to a page.
+         */
+        region_ptr heap;
+        vaddr_t heap_brk;
+
+        /* the stack region, which grows down on demand */
+        region_ptr stack;
+
+        /*
+         * TLB address space id on each cpu, valid only while
+         * asid_gen matches that cpu's current generation.
+         */
+        uint32_t asid[MAXCPUS];
+        uint32_t asid_gen[MAXCPUS];
+
+        struct stlb_entry stlb[VM_STLB_SIZE];
 
 #endif
 };
@@ -109,6 +192,37 @@ struct addrspace {
  *    as_define_region - set up a region of memory within the address
  *                space.
  *
+ *    as_asid   - return the TLB address space id of AS on this cpu,
+ *                assigning one if needed. Call with interrupts off.
+ *
+ *    as_tlb_invalidate - drop this cpu's TLB entry, if any, for the
+ *                page VADDR of AS.
+ *
+ *    as_tlb_printstats - print per-cpu TLB miss and ASID counters.
+ *
+ *    as_tlb_misses - total TLB misses taken on all cpus so far.
+ *
+ *    as_stlb_flush - empty the software TLB of AS.
+ *
+ *    as_sbrk   - move the heap break by AMOUNT bytes and hand back the
+ *                old break. Pages are populated lazily by vm_fault;
+ *                shrinking frees the pages given up.
+ *
+ *    as_mmap   - map LEN bytes of V at OFFSET, of which the file holds
+ *                BACKED, at an address of our choosing.
+ *
+ *    as_munmap - write back and remove the mapping made at ADDR.
+ *
+ *    as_sync_vnode - write back every mapping of V.
+ *
+ *    as_find_region - return the region containing VADDR, or NULL.
+ *
+ *    as_grow_stack - extend the stack down to VADDR if it may grow
+ *                that far; returns the stack region, or NULL.
+ *
+ *    as_define_file - make the region containing VADDR load its
+ *                contents lazily from a file.
+ *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
  *
@@ -134,6 +248,23 @@ int               as_define_region(struct addrspace *as,
                                    int readable,
                                    int writeable,
                                    int executable);
+uint32_t          as_asid(struct addrspace *as);
+void              as_tlb_invalidate(struct addrspace *as, vaddr_t vaddr);
+void              as_tlb_printstats(void);
+unsigned          as_tlb_misses(void);
+void              as_stlb_flush(struct addrspace *as);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbrk);
+int               as_mmap(struct addrspace *as, size_t len, int prot,
+                          struct vnode *v, off_t offset, size_t backed,
+                          vaddr_t *addr);
+int               as_munmap(struct addrspace *as, vaddr_t addr);
+int               as_sync_vnode(struct addrspace *as, struct vnode *v);
+region_ptr        as_find_region(struct addrspace *as, vaddr_t vaddr);
+region_ptr        as_grow_stack(struct addrspace *as, vaddr_t vaddr);
+int               as_define_file(struct addrspace *as, vaddr_t vaddr,
+                                 struct vnode *v, off_t offset,
+                                 size_t filesize);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
@@ -61,6 +61,8 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct frame_cache c_framecache; /* Free frames for this cpu */
+	struct cpu_tlb c_tlb;		/* ASIDs and TLB statistics */
 
 	/*
 	 * Accessed by other cpus.
@@ -155,6 +157,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast sends a shootdown to all CPUs except the
+ * current one and returns how many it was sent to.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +173,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
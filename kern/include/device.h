@@ -37,6 +37,27 @@
 
 struct uio;  /* in <uio.h> */
 
+/*
+ * Asynchronous block request.
+ *
+ * The caller fills in the first four fields and keeps the request
+ * and its buffer (which must be kernel memory, dr_nblocks times the
+ * device block size) alive until dev_wait returns. The rest belongs
+ * to the device.
+ */
+struct device_req {
+	uint32_t dr_block;		/* first device block */
+	uint32_t dr_nblocks;		/* number of blocks */
+	void *dr_data;			/* kernel buffer */
+	bool dr_write;			/* write (true) or read (false) */
+
+	uint32_t dr_ndone;		/* blocks transferred so far */
+	uint32_t dr_expire;		/* deadline, in device dispatches */
+	int dr_result;			/* errno once complete */
+	volatile bool dr_complete;	/* set when finished */
+	struct device_req *dr_next;	/* device queue link */
+};
+
 /*
  * Filesystem-namespace-accessible device.
  */
@@ -56,11 +77,18 @@ struct device {
  *      devop_eachopen - called on each open call to allow denying the open
  *      devop_io - for both reads and writes (the uio indicates the direction)
  *      devop_ioctl - miscellaneous control operations
+ *      devop_submit - queue a device_req and return without waiting
+ *      devop_wait - wait for a submitted device_req to finish
+ *
+ * devop_submit and devop_wait are optional; use dev_submit and
+ * dev_wait, which fall back to devop_io for devices without them.
  */
 struct device_ops {
 	int (*devop_eachopen)(struct device *, int flags_from_open);
 	int (*devop_io)(struct device *, struct uio *);
 	int (*devop_ioctl)(struct device *, int op, userptr_t data);
+	int (*devop_submit)(struct device *, struct device_req *);
+	int (*devop_wait)(struct device *, struct device_req *);
 };
 
 /*
@@ -71,6 +99,10 @@ struct device_ops {
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
 
 
+/* Asynchronous I/O on any device. */
+int dev_submit(struct device *dev, struct device_req *req);
+int dev_wait(struct device *dev, struct device_req *req);
+
 /* Create vnode for a vfs-level device. */
 struct vnode *dev_create_vnode(struct device *dev);
 
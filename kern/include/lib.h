@@ -133,6 +133,13 @@ void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
 
+/*
+ * kfree normally finds a subpage block's page through the frame
+ * table; switching that off falls back to searching every heap page,
+ * for comparison.
+ */
+void kheap_fastfree_set(bool on);
+
 /*
  * C string functions.
  *
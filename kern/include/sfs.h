@@ -56,6 +56,9 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	off_t sv_rapos;                 /* where the last read ended */
+	uint32_t sv_rawin;              /* read-ahead window, in blocks */
+	uint32_t sv_raend;              /* file block read-ahead reached */
 };
 
 /*
@@ -69,6 +72,8 @@ struct sfs_fs {
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	uint32_t sfs_nfree;             /* free blocks in the freemap */
+	uint32_t sfs_ndelayed;          /* file blocks not allocated yet */
 };
 
 /*
@@ -76,5 +81,12 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * Buffer cache control and statistics (in sfs_buf.c)
+ */
+void sfs_bufcache_set(bool on);
+bool sfs_bufcache_get(void);
+void sfs_bufcache_printstats(void);
+
 
 #endif /* _SFS_H_ */
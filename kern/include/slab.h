@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+/*
+ * Typed object caches for the kernel's most common structures.
+ *
+ * Each cache hands out objects of one size, carved from whole pages
+ * ("slabs") with the slab header at the start of the page. The frame
+ * table tags slab pages (see frame_set_owner), so kfree can tell a
+ * slab object from any other heap block in constant time, and the
+ * header gives the owning cache without any search. Every cpu keeps a
+ * magazine of free objects per cache so most allocations and frees
+ * take no lock at all.
+ *
+ * Caches are defined statically with KMEM_CACHE_INITIALIZER and need
+ * no setup, so they work as early as kmalloc does.
+ *
+ * Functions in slab.c:
+ *
+ *    kmem_cache_alloc - allocate one object from KC, or NULL if out
+ *                       of memory. The contents are undefined.
+ *
+ *    kmem_cache_free  - return an object to KC. kfree works too.
+ *
+ *    kmem_kfree       - kfree's hook: free PTR if it is a slab object
+ *                       and return 0, otherwise return -1.
+ *
+ *    kmem_printstats  - print usage of every cache used so far.
+ */
+
+#include <spinlock.h>
+#include <platform/maxcpus.h>
+
+#define KMEM_MAG_SIZE 16
+
+struct kmem_magazine {
+	unsigned km_count;
+	void *km_objs[KMEM_MAG_SIZE];
+};
+
+struct slab;
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			/* object size, rounded for alignment */
+	struct spinlock kc_lock;	/* protects the fields below */
+	struct slab *kc_partial;	/* slabs with free objects */
+	unsigned kc_nslabs;
+	unsigned kc_inuse;		/* objects outside the slabs */
+	unsigned kc_refills;		/* magazine refills */
+	unsigned kc_flushes;		/* magazine flushes */
+	bool kc_listed;			/* on the list kmem_printstats walks */
+	struct kmem_cache *kc_next;
+	struct kmem_magazine kc_mags[MAXCPUS];
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size) \
+	{ (name), (size), SPINLOCK_INITIALIZER, NULL, 0, 0, 0, 0, false, NULL, \
+	  { { 0, { NULL } } } }
+
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+int kmem_kfree(void *ptr);
+void kmem_printstats(void);
+
+
+#endif /* _SLAB_H_ */
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space on a raw disk device. The VM system pages user pages
+ * out here when physical memory runs short.
+ *
+ * Functions in swap.c:
+ *
+ *    swap_bootstrap - open SWAP_DEVICE. If it isn't there, swapping
+ *                     is simply disabled and the VM system behaves as
+ *                     if it had no backing store.
+ *
+ *    swap_enabled   - true if there is swap space at all.
+ *
+ *    swap_alloc     - reserve a free slot (one page) with a single
+ *                     reference. Returns ENOSPC if swap is full.
+ *
+ *    swap_incref    - add a reference to a slot; used when fork shares
+ *                     a swapped-out page between parent and child.
+ *
+ *    swap_free      - drop a reference; the slot is released with the
+ *                     last one.
+ *
+ *    swap_out       - write the physical page PADDR into SLOT.
+ *
+ *    swap_in        - read SLOT into the physical page PADDR.
+ *
+ *    swap_printstats - print slot usage and paging counters.
+ */
+
+#define SWAP_DEVICE "lhd0raw:"
+
+void swap_bootstrap(void);
+bool swap_enabled(void);
+int swap_alloc(unsigned *slot);
+void swap_incref(unsigned slot);
+void swap_free(unsigned slot);
+int swap_out(paddr_t paddr, unsigned slot);
+int swap_in(paddr_t paddr, unsigned slot);
+void swap_printstats(void);
+
+
+#endif /* _SWAP_H_ */
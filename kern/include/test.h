@@ -91,11 +91,18 @@ int longstress(int, char **);
 int createstress(int, char **);
 int printfile(int, char **);
 
+/* disk tests */
+int disktest(int, char **);
+
 /* other tests */
 int kmalloctest(int, char **);
 int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
+int kmalloctest5(int, char **);
+int frametest(int, char **);
+int pttest(int, char **);
+int tlbtest(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
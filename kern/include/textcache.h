@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _TEXTCACHE_H_
+#define _TEXTCACHE_H_
+
+/*
+ * Shared pages of program text. Read-only, executable pages loaded
+ * from an executable are kept here, indexed by vnode and virtual
+ * page, so that every process running the same binary maps the same
+ * frames. The cache holds one reference on each frame (see the frame
+ * table refcount) and one on the vnode.
+ *
+ * Functions in textcache.c:
+ *
+ *    textcache_bootstrap - set up the cache.
+ *
+ *    textcache_lookup - if the page at VADDR of V is cached, take a
+ *                       frame reference for the caller and return its
+ *                       physical address, else 0.
+ *
+ *    textcache_insert - enter the loaded frame PADDR for VADDR of V.
+ *                       The cache takes its own frame reference; the
+ *                       caller keeps the one it has. Returns false if
+ *                       the page could not be entered (or another
+ *                       process got there first), leaving it private.
+ *
+ *    textcache_evict  - if the frame PADDR is cached and mapped only by
+ *                       the caller's page, forget it and drop the
+ *                       cache's frame reference. Returns the vnode,
+ *                       whose reference the caller must drop once it
+ *                       may sleep, or NULL if the page is in use.
+ *
+ *    textcache_release - drop the cached frame PADDR if nobody maps it
+ *                       any more. Called, possibly under a spinlock,
+ *                       as each text page is unmapped.
+ *
+ *    textcache_reap   - drop the vnode references of released pages.
+ *                       Called with no locks held, e.g. once an
+ *                       address space has been torn down.
+ *
+ *    textcache_printstats - print hit/miss counters.
+ */
+
+struct vnode;
+
+void textcache_bootstrap(void);
+paddr_t textcache_lookup(struct vnode *v, vaddr_t vaddr);
+bool textcache_insert(struct vnode *v, vaddr_t vaddr, paddr_t paddr);
+struct vnode *textcache_evict(paddr_t paddr);
+void textcache_release(paddr_t paddr);
+void textcache_reap(void);
+void textcache_printstats(void);
+
+
+#endif /* _TEXTCACHE_H_ */
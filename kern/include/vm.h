@@ -38,6 +38,7 @@
 
 
 #include <machine/vm.h>
+#include "opt-hpt.h"
 
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
@@ -47,7 +48,18 @@
 #define L1_PAGE_MASK 0xFFE00000 /* mask for getting level 1 page number from addr */
 #define L2_PAGE_MASK   0x1FF000 /* mask for getting level 2 page number from addr */
 
-#define L1_PAGETABLE_NUM 2048 
+/*
+ * The page table covers user space (kuseg) only, so a level 1 index
+ * is 0..1023. Rather than one 1024-entry array per process, level 1
+ * is itself split in two: a 32-entry directory kept in struct
+ * pagetable, whose entries point to 32-entry middle tables (128
+ * bytes) made on demand. A process touching text, data, heap and
+ * stack needs the 128-byte struct, two or three middle tables and
+ * its L2 tables, instead of a multi-page kmalloc.
+ */
+#define PT_DIR_NUM 32
+#define PT_MID_NUM 32
+#define L1_PAGETABLE_NUM (PT_DIR_NUM * PT_MID_NUM)
 #define L2_PAGETABLE_NUM 512
 
 //The upper 20 bits of the page table entry are the physical page number
@@ -56,9 +68,22 @@
 #define FLAG_WRITE        0x002 /* mask for getting writable bit from page table entry */ 
 #define FLAG_EXECUTE      0x004 /* mask for getting executable bit from page table entry */
 #define FLAG_INMEMORY     0x008 /* mask for getting in-memory bit from page table entry */  //!unused
-#define FLAG_DIRTY        0x010 /* mask for getting dirty bit from page table entry */      //!unused
+#define FLAG_DIRTY        0x010 /* mask for getting dirty bit from page table entry */
 #define FLAG_VALID        0x020 /* mask for getting valid bit from page table entry */      //!unused
 #define FLAG_USED         0x040 /* mask for getting used bit from page table entry */       
+#define FLAG_SWAPPED      0x080 /* page is on swap; the upper 20 bits hold its slot */
+#define FLAG_PREFETCHED   0x001 /* PTE only: loaded into the TLB by fault-around */
+#define FLAG_BUSY         0x002 /* PTE only: being paged in or out, wait for it */
+#define FLAG_TEXT         0x004 /* PTE only: the frame is also held by the text cache */
+
+/*
+ * FLAG_DIRTY marks a page of a file mapping that has been written
+ * since it was last written back. Such pages are mapped without
+ * TLBLO_DIRTY until the first write faults.
+ *
+ * FLAG_USED is the reference bit for page replacement: vm_fault sets
+ * it whenever it loads a page into the TLB, the clock hand clears it.
+ */
 
 #define PAGE_NUM(paddr) (paddr & PAGE_FRAME)        /* getting page number from addr */
 #define L1_PAGE_NUM(vaddr) (((vaddr) & L1_PAGE_MASK) >> 21)  /* getting level 1 page number from addr */
@@ -66,23 +91,85 @@
 
 #define ZERO_FILLED_PAGE(vaddr_base) bzero(vaddr_base, PAGE_SIZE)
 
+#define SWAP_SLOT(entry) ((entry) >> 12)                     /* swap slot of a swapped-out page */
+#define SWAP_ENTRY(slot) ((((uint32_t)(slot)) << 12) | FLAG_SWAPPED) /* page table entry for a swap slot */
+
 #define SET_FLAG(entry, flag) ((entry) |= (flag))       /* set flag */
 #define CLEAR_FLAG(entry, flag) ((entry) &= ~(flag))    /* clear flag */ 
 #define IS_FLAG_SET(entry, flag) ((entry) & (flag))     /* check flag */
 
 
-typedef uint32_t page_table_entry, *l2_page_tabel, **l1_page_table;
+typedef uint32_t page_table_entry, *l2_page_tabel;
+
+#if OPT_HPT
+/*
+ * With "options hpt" the PTEs of every process live in one hashed
+ * table sized from physical memory (see vm.c); struct pagetable is
+ * only the key and the head of the list of entries it owns.
+ */
+struct pagetable {
+    uint32_t pt_first;      /* first hashed entry we own, or HPT_NONE */
+    unsigned pt_nentries;
+};
+#else
+struct pagetable {
+    l2_page_tabel *pt_dir[PT_DIR_NUM];  /* middle tables, or NULL */
+};
+#endif
+typedef struct pagetable *l1_page_table;
 
 l1_page_table pagetable_create_l1(void);
 
+#if !OPT_HPT
+/* the L2 table for level 1 index L1_PTABLE_NUM, or NULL if none yet */
+l2_page_tabel pagetable_get_l2(l1_page_table pagetable, uint16_t l1_ptable_num);
+
 uint32_t pagetable_create_l2(l1_page_table pagetable, uint16_t l1_ptable_num);
+#endif
+
+uint32_t pagetable_insert(page_table_entry *pte, uint32_t dirty_bit);
 
-uint32_t pagetable_insert(l1_page_table pagetable, uint16_t l1_ptable_num, uint16_t l2_page_num, uint32_t dirty_bit);
+uint32_t pagetable_swapin(page_table_entry *pte);
 
 uint32_t pagetable_copy(l1_page_table src_ptable, l1_page_table dest_ptable);
 
+uint32_t pagetable_cow(page_table_entry *pte);
+
 void pagetable_destroy(l1_page_table pagetable);
 
+/*
+ * Page table memory, for benchmarks: bytes used by one page table,
+ * and bytes allocated once at boot for all of them (the hashed table).
+ */
+size_t pagetable_size(l1_page_table pagetable);
+size_t pagetable_global_size(void);
+
+/*
+ * Release the pages mapped in [start, end). The caller must make sure
+ * no TLB still holds them (see as_sbrk).
+ */
+void pagetable_unmap(l1_page_table pagetable, vaddr_t start, vaddr_t end);
+
+/*
+ * Write the FLAG_DIRTY pages among the LEN bytes mapped at START back
+ * to V at OFFSET, and mark them clean. As with pagetable_unmap, the
+ * caller deals with the TLB.
+ */
+struct vnode;
+int pagetable_writeback(l1_page_table pagetable, vaddr_t start, size_t len,
+                        struct vnode *v, off_t offset);
+
+/* TLB fault-around window, in pages after the faulting one */
+#define VM_FAULTAROUND_DEFAULT 4
+#define VM_FAULTAROUND_MAX     16
+
+void vm_set_faultaround(unsigned npages);
+unsigned vm_get_faultaround(void);
+
+/* Switch the software TLB fast path in vm_fault on or off */
+void vm_set_stlb(bool on);
+bool vm_get_stlb(void);
+
 /* Initialization function */
 void vm_bootstrap(void);
 
@@ -93,6 +180,38 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Allocate one zero-filled page, normally from the pool kept by the
+ * zeroing thread that frame_zero_bootstrap starts; the pool can be
+ * switched off to compare.
+ */
+vaddr_t alloc_zeroed_kpage(void);
+void frame_zero_bootstrap(void);
+void frame_zero_pool_set(bool on);
+bool frame_zero_pool_get(void);
+
+/* Share a frame between page tables / count its sharers (copy-on-write) */
+void frame_incref(paddr_t paddr);
+unsigned frame_getref(paddr_t paddr);
+
+/*
+ * Per-page owner tags for the kernel heap, so kfree can find the
+ * allocator metadata of a block without searching. Pages of a new
+ * alloc_kpages block start out as FRAME_OWNER_NONE.
+ */
+#define FRAME_OWNER_NONE    0
+#define FRAME_OWNER_SLAB    1   /* owner is the struct slab */
+#define FRAME_OWNER_SUBPAGE 2   /* owner is kmalloc's struct pageref */
+void frame_set_owner(vaddr_t vaddr, unsigned type, void *owner);
+void *frame_get_owner(vaddr_t vaddr, unsigned *type);
+
+/* Frame allocator occupancy, for statistics and benchmarks */
+void frame_table_stats(unsigned *nframes, unsigned *nfree);
+void frame_table_printstats(void);
+
+/* Rough free frame count without locking, for the pager */
+unsigned frame_table_nfree(void);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
@@ -120,9 +120,12 @@ struct vnode {
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
- *    vop_mmap        - Map file into memory. If you implement this
- *                      feature, you're responsible for choosing the
- *                      arguments for this operation.
+ *    vop_mmap        - Prepare to map LEN bytes of the file starting
+ *                      at OFFSET into memory. Returns in BACKED how
+ *                      many of those bytes the file currently holds;
+ *                      the rest of the mapping reads as zeros. The
+ *                      VM system then pages the data in and out with
+ *                      vop_read and vop_write.
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
@@ -193,7 +196,8 @@ struct vnode_ops {
 	int (*vop_gettype)(struct vnode *object, mode_t *result);
 	bool (*vop_isseekable)(struct vnode *object);
 	int (*vop_fsync)(struct vnode *object);
-	int (*vop_mmap)(struct vnode *file /* add stuff */);
+	int (*vop_mmap)(struct vnode *file, off_t offset, size_t len,
+			size_t *backed);
 	int (*vop_truncate)(struct vnode *file, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
 
@@ -237,7 +241,7 @@ struct vnode_ops {
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
-#define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
+#define VOP_MMAP(vn, off, len, res)     (__VOP(vn, mmap)(vn, off, len, res))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
@@ -286,9 +290,12 @@ int vopfail_uio_notdir(struct vnode *vn, struct uio *uio);
 int vopfail_uio_isdir(struct vnode *vn, struct uio *uio);
 int vopfail_uio_inval(struct vnode *vn, struct uio *uio);
 int vopfail_uio_nosys(struct vnode *vn, struct uio *uio);
-int vopfail_mmap_isdir(struct vnode *vn /* add stuff */);
-int vopfail_mmap_perm(struct vnode *vn /* add stuff */);
-int vopfail_mmap_nosys(struct vnode *vn /* add stuff */);
+int vopfail_mmap_isdir(struct vnode *vn, off_t offset, size_t len,
+		       size_t *backed);
+int vopfail_mmap_perm(struct vnode *vn, off_t offset, size_t len,
+		      size_t *backed);
+int vopfail_mmap_nosys(struct vnode *vn, off_t offset, size_t len,
+		       size_t *backed);
 int vopfail_truncate_isdir(struct vnode *vn, off_t pos);
 int vopfail_creat_notdir(struct vnode *vn, const char *name, bool excl,
 			 mode_t mode, struct vnode **result);
@@ -37,6 +37,10 @@
 #include <uio.h>
 #include <clock.h>
 #include <mainbus.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <swap.h>
+#include <textcache.h>
 #include <synch.h>
 #include <thread.h>
 #include <proc.h>
@@ -47,6 +51,8 @@
 #include <test.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-unsw.h"
+#include "opt-dumbvm.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -467,9 +473,84 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+#if OPT_UNSW
+	frame_table_printstats();
+#endif
+#if !OPT_DUMBVM
+	swap_printstats();
+	textcache_printstats();
+	as_tlb_printstats();
+#endif
+#if OPT_SFS
+	sfs_bufcache_printstats();
+#endif
+
+	return 0;
+}
+
+#if OPT_SFS
+/*
+ * Command for switching the SFS buffer cache on and off.
+ */
+static
+int
+cmd_bufcache(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		sfs_bufcache_set(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		sfs_bufcache_set(false);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: bc [on|off]\n");
+		return EINVAL;
+	}
+	sfs_bufcache_printstats();
+	return 0;
+}
+#endif
+
+#if !OPT_DUMBVM
+/*
+ * Command for setting the TLB fault-around window.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	if (nargs == 2) {
+		vm_set_faultaround(atoi(args[1]));
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: fa [pages]\n");
+		return EINVAL;
+	}
+	kprintf("TLB fault-around: %u pages\n", vm_get_faultaround());
+	return 0;
+}
 
+/*
+ * Command for switching the pre-zeroed page pool on and off.
+ */
+static
+int
+cmd_zeropool(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		frame_zero_pool_set(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		frame_zero_pool_set(false);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: zp [on|off]\n");
+		return EINVAL;
+	}
+	kprintf("Zero page pool: %s\n", frame_zero_pool_get() ? "on" : "off");
 	return 0;
 }
+#endif
 
 static
 int
@@ -542,6 +623,13 @@ static const char *opsmenu[] = {
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
+#if !OPT_DUMBVM
+	"[fa]      Set TLB fault-around      ",
+	"[zp]      Zero page pool on/off     ",
+#endif
+#if OPT_SFS
+	"[bc]      Buffer cache on/off       ",
+#endif
 	"[q]       Quit and shut down        ",
 	NULL
 };
@@ -566,6 +654,14 @@ static const char *testmenu[] = {
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[km5] kfree benchmark               ",
+#if OPT_UNSW
+	"[ft1] Frame allocator benchmark     ",
+#endif
+#if !OPT_DUMBVM
+	"[pt1] Page table benchmark          ",
+	"[pt2] TLB miss benchmark            ",
+#endif
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -584,6 +680,7 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[dq]  Disk queue benchmark          ",
 	NULL
 };
 
@@ -650,6 +747,13 @@ static struct {
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
 	{ "q",		cmd_quit },
+#if !OPT_DUMBVM
+	{ "fa",		cmd_faultaround },
+	{ "zp",		cmd_zeropool },
+#endif
+#if OPT_SFS
+	{ "bc",		cmd_bufcache },
+#endif
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
 
@@ -667,6 +771,14 @@ static struct {
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "km5",	kmalloctest5 },
+#if OPT_UNSW
+	{ "ft1",	frametest },
+#endif
+#if !OPT_DUMBVM
+	{ "pt1",	pttest },
+	{ "pt2",	tlbtest },
+#endif
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -715,6 +827,7 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
+	{ "dq",		disktest },
 
 	{ NULL, NULL }
 };
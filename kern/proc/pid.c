@@ -43,6 +43,7 @@
 #include <current.h>
 #include <synch.h>
 #include <pid.h>
+#include <slab.h>
 
 /*
  * Structure for holding exit data of a thread.
@@ -59,6 +60,9 @@ struct pidinfo {
 	struct cv *pi_cv;		// use to wait for thread exit
 };
 
+static struct kmem_cache pidinfo_cache =
+	KMEM_CACHE_INITIALIZER("pidinfo", sizeof(struct pidinfo));
+
 
 /*
  * Global pid and exit data.
@@ -86,14 +90,14 @@ pidinfo_create(pid_t pid, pid_t ppid)
 
 	KASSERT(pid != INVALID_PID);
 
-	pi = kmalloc(sizeof(struct pidinfo));
+	pi = kmem_cache_alloc(&pidinfo_cache);
 	if (pi==NULL) {
 		return NULL;
 	}
 
 	pi->pi_cv = cv_create("pidinfo cv");
 	if (pi->pi_cv == NULL) {
-		kfree(pi);
+		kmem_cache_free(&pidinfo_cache, pi);
 		return NULL;
 	}
 
@@ -115,7 +119,7 @@ pidinfo_destroy(struct pidinfo *pi)
 	KASSERT(pi->pi_exited == true);
 	KASSERT(pi->pi_ppid == INVALID_PID);
 	cv_destroy(pi->pi_cv);
-	kfree(pi);
+	kmem_cache_free(&pidinfo_cache, pi);
 }
 
 ////////////////////////////////////////////////////////////
@@ -69,10 +69,14 @@
  * FILESIZE may be less than MEMSIZE; if so the remaining portion of
  * the in-memory segment should be zero-filled.
  *
- * Note that uiomove will catch it if someone tries to load an
- * executable whose load address is in kernel space. If you should
- * change this code to not use uiomove, be sure to check for this case
- * explicitly.
+ * The segment is not read here. The region it lives in remembers the
+ * file and offset, and vm_fault reads each page in the first time it
+ * is touched, so exec costs time in proportion to the pages a program
+ * uses rather than the size of the binary. The region's zero-filled
+ * pages take care of the part past FILESIZE.
+ *
+ * uiomove used to catch load addresses in kernel space; as this no
+ * longer uses uiomove, check for that explicitly.
  */
 static
 int
@@ -81,70 +85,24 @@ load_segment(struct addrspace *as, struct vnode *v,
 	     size_t memsize, size_t filesize,
 	     int is_executable)
 {
-	struct iovec iov;
-	struct uio u;
-	int result;
+	(void)is_executable;
 
 	if (filesize > memsize) {
 		kprintf("ELF: warning: segment filesize > segment memsize\n");
 		filesize = memsize;
 	}
 
-	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n",
-	      (unsigned long) filesize, (unsigned long) vaddr);
-
-	iov.iov_ubase = (userptr_t)vaddr;
-	iov.iov_len = memsize;		 // length of the memory space
-	u.uio_iov = &iov;
-	u.uio_iovcnt = 1;
-	u.uio_resid = filesize;          // amount to read from the file
-	u.uio_offset = offset;
-	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
-	u.uio_rw = UIO_READ;
-	u.uio_space = as;
-
-	result = VOP_READ(v, &u);
-	if (result) {
-		return result;
+	if (vaddr >= USERSPACETOP || memsize > USERSPACETOP - vaddr) {
+		return EFAULT;
 	}
 
-	if (u.uio_resid != 0) {
-		/* short read; problem with executable? */
-		kprintf("ELF: short read on segment - file truncated?\n");
-		return ENOEXEC;
-	}
-
-	/*
-	 * If memsize > filesize, the remaining space should be
-	 * zero-filled. There is no need to do this explicitly,
-	 * because the VM system should provide pages that do not
-	 * contain other processes' data, i.e., are already zeroed.
-	 *
-	 * During development of your VM system, it may have bugs that
-	 * cause it to (maybe only sometimes) not provide zero-filled
-	 * pages, which can cause user programs to fail in strange
-	 * ways. Explicitly zeroing program BSS may help identify such
-	 * bugs, so the following disabled code is provided as a
-	 * diagnostic tool. Note that it must be disabled again before
-	 * you submit your code for grading.
-	 */
-#if 0
-	{
-		size_t fillamt;
-
-		fillamt = memsize - filesize;
-		if (fillamt > 0) {
-			DEBUG(DB_EXEC, "ELF: Zero-filling %lu more bytes\n",
-			      (unsigned long) fillamt);
-			u.uio_resid += fillamt;
-			result = uiomovezeros(fillamt, &u);
-		}
-	}
-#endif
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
 
-	return result;
+	return as_define_file(as, vaddr, v, offset, filesize);
 }
 
+
 /*
  * Load an ELF executable user program into the current address space.
  *
@@ -259,7 +217,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Now actually load each segment.
+	 * Now record where each segment's contents come from.
 	 */
 
 	for (i=0; i<eh.e_phnum; i++) {
@@ -48,6 +48,8 @@
 #include <openfile.h>
 #include <filetable.h>
 #include <syscall.h>
+#include <addrspace.h>
+#include "opt-dumbvm.h"
 
 /*
  * Note: if you are receiving this code as a patch to integrate with
@@ -387,6 +389,14 @@ sys_fsync(int fd)
 	 * and we're not using any of its non-constant fields.
 	 */
 
+#if !OPT_DUMBVM
+	/* changes made through mmap have to reach the file first */
+	err = as_sync_vnode(proc_getas(), file->of_vnode);
+	if (err) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return err;
+	}
+#endif
 	err = VOP_FSYNC(file->of_vnode);
 	filetable_put(curproc->p_filetable, fd, file);
 	return err;
@@ -38,6 +38,10 @@
 #include <synch.h>
 #include <vfs.h>
 #include <openfile.h>
+#include <slab.h>
+
+static struct kmem_cache openfile_cache =
+	KMEM_CACHE_INITIALIZER("openfile", sizeof(struct openfile));
 
 /*
  * Constructor for struct openfile.
@@ -53,14 +57,14 @@ openfile_create(struct vnode *vn, int accmode)
 		accmode == O_WRONLY ||
 		accmode == O_RDWR);
 
-	file = kmalloc(sizeof(struct openfile));
+	file = kmem_cache_alloc(&openfile_cache);
 	if (file == NULL) {
 		return NULL;
 	}
 
 	file->of_offsetlock = lock_create("openfile");
 	if (file->of_offsetlock == NULL) {
-		kfree(file);
+		kmem_cache_free(&openfile_cache, file);
 		return NULL;
 	}
 
@@ -87,7 +91,7 @@ openfile_destroy(struct openfile *file)
 
 	spinlock_cleanup(&file->of_reflock);
 	lock_destroy(file->of_offsetlock);
-	kfree(file);
+	kmem_cache_free(&openfile_cache, file);
 }
 
 /*
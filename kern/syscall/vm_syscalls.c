@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Memory-management system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <syscall.h>
+
+/*
+ * sbrk() - move the end of the heap. Returns the old break.
+ */
+int
+sys_sbrk(intptr_t amount, int32_t *retval)
+{
+	struct addrspace *as;
+	vaddr_t oldbrk;
+	int result;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	result = as_sbrk(as, amount, &oldbrk);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)oldbrk;
+	return 0;
+}
+
+/*
+ * mmap() - map LEN bytes of the file open on FD, starting at the
+ * page-aligned OFFSET, somewhere in the address space. Pages are read
+ * in as they are touched; with PROT_WRITE, modified pages go back to
+ * the file on munmap, fsync, or exit. The part of the mapping beyond
+ * the end of the file reads as zeros and is never written back.
+ */
+int
+sys_mmap(size_t len, int prot, int fd, off_t offset, int32_t *retval)
+{
+	struct openfile *file;
+	size_t backed;
+	vaddr_t addr;
+	int result;
+
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if (prot & ~(PROT_READ | PROT_WRITE)) {
+		return EINVAL;
+	}
+
+	result = filetable_get(curproc->p_filetable, fd, &file);
+	if (result) {
+		return result;
+	}
+
+	/* we read the file to fill the mapping, and write it if writable */
+	if (file->of_accmode == O_WRONLY ||
+	    ((prot & PROT_WRITE) && file->of_accmode != O_RDWR)) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return EACCES;
+	}
+
+	result = VOP_MMAP(file->of_vnode, offset, len, &backed);
+	if (result == 0) {
+		result = as_mmap(proc_getas(), len, prot, file->of_vnode,
+				 offset, backed, &addr);
+	}
+	filetable_put(curproc->p_filetable, fd, file);
+	if (result) {
+		return result;
+	}
+
+	*retval = (int32_t)addr;
+	return 0;
+}
+
+/*
+ * munmap() - remove a mapping made by mmap, writing back changes.
+ */
+int
+sys_munmap(userptr_t addr)
+{
+	return as_munmap(proc_getas(), (vaddr_t)addr);
+}
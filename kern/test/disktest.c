@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Benchmarks for the disk driver.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <clock.h>
+#include <uio.h>
+#include <thread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <test.h>
+
+////////////////////////////////////////////////////////////
+// dq
+
+/*
+ * Random single-sector reads from a raw disk with 1, 2, 4, ... up to
+ * DQ_MAXDEPTH threads reading at once, which is how many requests
+ * the driver has queued. With one reader every request pays a full
+ * seek; with more, the elevator can pick whichever is nearest, so
+ * the request rate should go up with the depth. Reads only, so it's
+ * safe on a disk with a filesystem on it.
+ */
+
+#define DQ_NREQS     512	/* total reads at each depth */
+#define DQ_MAXDEPTH  32
+#define DQ_SECTSIZE  512
+
+static struct vnode *dq_vn;
+static uint32_t dq_nsect;
+static unsigned dq_perthread;
+static unsigned dq_nerrs;
+static struct semaphore *dq_sem;
+
+static
+void
+dq_thread(void *junk, unsigned long num)
+{
+	char buf[DQ_SECTSIZE];
+	struct iovec iov;
+	struct uio ku;
+	uint32_t sector;
+	unsigned i;
+	int result;
+
+	(void)junk;
+	(void)num;
+
+	for (i = 0; i < dq_perthread; i++) {
+		sector = random() % dq_nsect;
+		uio_kinit(&iov, &ku, buf, sizeof(buf),
+			  (off_t)sector * DQ_SECTSIZE, UIO_READ);
+		result = VOP_READ(dq_vn, &ku);
+		if (result) {
+			kprintf("dq: sector %u: %s\n", sector,
+				strerror(result));
+			dq_nerrs++;
+			break;
+		}
+	}
+	V(dq_sem);
+}
+
+/*
+ * Run DQ_NREQS reads spread over DEPTH threads.
+ */
+static
+int
+dq_run(unsigned depth)
+{
+	struct timespec before, after, duration;
+	uint64_t usecs;
+	unsigned i;
+	int result;
+
+	dq_perthread = DQ_NREQS / depth;
+	dq_nerrs = 0;
+
+	gettime(&before);
+	for (i = 0; i < depth; i++) {
+		result = thread_fork("dq", NULL, dq_thread, NULL, i);
+		if (result) {
+			kprintf("dq: thread_fork failed: %s\n",
+				strerror(result));
+			while (i-- > 0) {
+				P(dq_sem);
+			}
+			return result;
+		}
+	}
+	for (i = 0; i < depth; i++) {
+		P(dq_sem);
+	}
+	gettime(&after);
+
+	if (dq_nerrs > 0) {
+		return EIO;
+	}
+
+	timespec_sub(&after, &before, &duration);
+	usecs = (uint64_t)duration.tv_sec * 1000000 + duration.tv_nsec / 1000;
+	kprintf("dq: depth %2u: %u reads in %llu ms, %llu reads/sec\n",
+		depth, dq_perthread * depth, usecs / 1000,
+		usecs ? (uint64_t)dq_perthread * depth * 1000000 / usecs : 0);
+	return 0;
+}
+
+int
+disktest(int nargs, char **args)
+{
+	char path[32];
+	struct stat st;
+	unsigned depth;
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: dq [rawdevice]\n");
+		return EINVAL;
+	}
+	snprintf(path, sizeof(path), "%s", nargs == 2 ? args[1] : "lhd0raw:");
+
+	kprintf("Starting disk queue benchmark on %s...\n", path);
+
+	result = vfs_open(path, O_RDONLY, 0, &dq_vn);
+	if (result) {
+		kprintf("dq: %s: %s\n", path, strerror(result));
+		return result;
+	}
+	result = VOP_STAT(dq_vn, &st);
+	if (result || st.st_size < DQ_SECTSIZE) {
+		kprintf("dq: %s is not a disk\n", path);
+		vfs_close(dq_vn);
+		return result ? result : EINVAL;
+	}
+	dq_nsect = st.st_size / DQ_SECTSIZE;
+
+	dq_sem = sem_create("dq", 0);
+	if (dq_sem == NULL) {
+		vfs_close(dq_vn);
+		return ENOMEM;
+	}
+
+	for (depth = 1; depth <= DQ_MAXDEPTH; depth *= 2) {
+		result = dq_run(depth);
+		if (result) {
+			break;
+		}
+	}
+
+	sem_destroy(dq_sem);
+	vfs_close(dq_vn);
+	kprintf("Disk queue benchmark done\n");
+	return result;
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Benchmarks for the frame allocator.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <vm.h>
+#include <test.h>
+
+////////////////////////////////////////////////////////////
+// ft1
+
+/*
+ * Measure single-frame allocation throughput with memory 10%, 50%
+ * and 95% full. For each level we first pin enough frames ("ballast")
+ * to reach the target utilisation, then time FT1_ALLOCS calls to
+ * alloc_kpages(1) done in batches of FT1_BATCH, freeing each batch
+ * before starting the next.
+ */
+
+#define FT1_ALLOCS  20000
+#define FT1_BATCH   32
+#define FT1_NLEVELS 3
+
+static const unsigned ft1_levels[FT1_NLEVELS] = { 10, 50, 95 };
+
+/*
+ * The ballast frames are chained through their first word, so
+ * remembering them needs no memory beyond the frames themselves.
+ */
+static vaddr_t ballast;
+
+static
+unsigned
+ballast_fill(unsigned percent)
+{
+	unsigned nframes, nfree, used, target, count;
+	vaddr_t page;
+
+	frame_table_stats(&nframes, &nfree);
+	used = nframes - nfree;
+	target = (nframes / 100) * percent;
+
+	for (count = 0; used + count < target; count++) {
+		page = alloc_kpages(1);
+		if (page == 0) {
+			break;
+		}
+		*(vaddr_t *)page = ballast;
+		ballast = page;
+	}
+	return count;
+}
+
+static
+void
+ballast_release(void)
+{
+	vaddr_t page;
+
+	while (ballast != 0) {
+		page = ballast;
+		ballast = *(vaddr_t *)page;
+		free_kpages(page);
+	}
+}
+
+static
+void
+ft1_level(unsigned percent)
+{
+	vaddr_t batch[FT1_BATCH];
+	struct timespec before, after, duration;
+	unsigned nframes, nfree, pinned, done, n, i;
+	uint64_t nsecs, rate;
+
+	pinned = ballast_fill(percent);
+	frame_table_stats(&nframes, &nfree);
+
+	gettime(&before);
+	for (done = 0; done < FT1_ALLOCS; done += n) {
+		for (n = 0; n < FT1_BATCH; n++) {
+			batch[n] = alloc_kpages(1);
+			if (batch[n] == 0) {
+				break;
+			}
+		}
+		for (i = 0; i < n; i++) {
+			free_kpages(batch[i]);
+		}
+		if (n == 0) {
+			break;
+		}
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+
+	ballast_release();
+
+	nsecs = (uint64_t)duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+	rate = nsecs ? (uint64_t)done * 1000000000ULL / nsecs : 0;
+
+	kprintf("ft1: %2u%% used (%u/%u frames, %u pinned): "
+		"%u allocs in %llu.%09lu sec, %llu allocs/sec\n",
+		percent, nframes - nfree, nframes, pinned, done,
+		(unsigned long long) duration.tv_sec,
+		(unsigned long) duration.tv_nsec,
+		(unsigned long long) rate);
+}
+
+/*
+ * Time FT1_ZALLOCS calls to alloc_zeroed_kpage with the zero pool
+ * switched on or off. Between batches we yield, as a faulting process
+ * would, so the zeroing thread gets to refill the pool; only the
+ * allocations themselves are timed.
+ */
+
+#define FT1_ZALLOCS 2000
+
+static
+void
+ft1_zero(bool pool)
+{
+	vaddr_t batch[FT1_BATCH];
+	struct timespec before, after, duration;
+	unsigned done, n, i;
+	uint64_t nsecs;
+
+	frame_zero_pool_set(pool);
+	nsecs = 0;
+	for (done = 0; done < FT1_ZALLOCS; done += n) {
+		thread_yield();
+		gettime(&before);
+		for (n = 0; n < FT1_BATCH; n++) {
+			batch[n] = alloc_zeroed_kpage();
+			if (batch[n] == 0) {
+				break;
+			}
+		}
+		gettime(&after);
+		timespec_sub(&after, &before, &duration);
+		nsecs += (uint64_t)duration.tv_sec * 1000000000ULL +
+			duration.tv_nsec;
+		for (i = 0; i < n; i++) {
+			free_kpages(batch[i]);
+		}
+		if (n == 0) {
+			break;
+		}
+	}
+
+	kprintf("ft1: zero-fill with pool %s: %u allocs, avg %llu ns\n",
+		pool ? "on" : "off", done,
+		(unsigned long long)(done ? nsecs / done : 0));
+}
+
+int
+frametest(int nargs, char **args)
+{
+	unsigned i;
+	bool pool;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting frame allocator benchmark...\n");
+	for (i = 0; i < FT1_NLEVELS; i++) {
+		ft1_level(ft1_levels[i]);
+	}
+	pool = frame_zero_pool_get();
+	ft1_zero(false);
+	ft1_zero(true);
+	frame_zero_pool_set(pool);
+	kprintf("Frame allocator benchmark done\n");
+	return 0;
+}
@@ -36,6 +36,7 @@
 #include <thread.h>
 #include <synch.h>
 #include <vm.h> /* for PAGE_SIZE */
+#include <clock.h>
 #include <test.h>
 
 #include "opt-dumbvm.h"
@@ -379,3 +380,167 @@ kmalloctest4(int nargs, char **args)
 	kprintf("Multipage kmalloc test done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km5
+
+/*
+ * kfree speed on a fragmented heap. A ballast of long-lived blocks is
+ * left on every subpage page, so the heap has a few hundred partly
+ * used pages that never go away. Then KM5_ROUNDS batches of KM5_BATCH
+ * blocks are allocated into the holes and freed again, plus a batch
+ * of whole-page blocks, first with kfree searching the heap pages and
+ * then with the frame table lookup. Only the frees are timed.
+ */
+
+#define KM5_BATCH   10000
+#define KM5_ROUNDS  10
+#define KM5_NPAGES  64
+#define NUM_KM5_SIZES 4
+
+static const unsigned km5_sizes[NUM_KM5_SIZES] = { 16, 40, 64, 120 };
+
+static
+uint64_t
+km5_nsecs(const struct timespec *before, const struct timespec *after)
+{
+	struct timespec duration;
+
+	timespec_sub(after, before, &duration);
+	return (uint64_t)duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+}
+
+/*
+ * Allocate and free the batches once; return the time spent freeing
+ * subpage blocks in *SUBNS and whole pages in *PAGENS.
+ */
+static
+int
+km5_run(void **ptrs, uint64_t *subns, uint64_t *pagens)
+{
+	struct timespec before, after;
+	unsigned r, i;
+
+	*subns = *pagens = 0;
+	for (r = 0; r < KM5_ROUNDS; r++) {
+		for (i = 0; i < KM5_BATCH; i++) {
+			ptrs[i] = kmalloc(km5_sizes[i % NUM_KM5_SIZES]);
+			if (ptrs[i] == NULL) {
+				while (i-- > 0) {
+					kfree(ptrs[i]);
+				}
+				return ENOMEM;
+			}
+		}
+		gettime(&before);
+		for (i = 0; i < KM5_BATCH; i++) {
+			kfree(ptrs[i]);
+		}
+		gettime(&after);
+		*subns += km5_nsecs(&before, &after);
+	}
+
+	for (i = 0; i < KM5_NPAGES; i++) {
+		ptrs[i] = kmalloc(PAGE_SIZE);
+		if (ptrs[i] == NULL) {
+			while (i-- > 0) {
+				kfree(ptrs[i]);
+			}
+			return ENOMEM;
+		}
+	}
+	gettime(&before);
+	for (i = 0; i < KM5_NPAGES; i++) {
+		kfree(ptrs[i]);
+	}
+	gettime(&after);
+	*pagens = km5_nsecs(&before, &after);
+
+	return 0;
+}
+
+int
+kmalloctest5(int nargs, char **args)
+{
+	void **ballast, **ptrs;
+	uint64_t subns[2], pagens[2];
+	unsigned i, nballast;
+	int result, mode;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting kfree benchmark...\n");
+#if !OPT_UNSW
+	kprintf("(Without the UNSW frame table both runs search the heap)\n");
+#endif
+
+	ballast = kmalloc(KM5_BATCH * sizeof(void *));
+	ptrs = kmalloc(KM5_BATCH * sizeof(void *));
+	if (ballast == NULL || ptrs == NULL) {
+		kfree(ballast);
+		kfree(ptrs);
+		kprintf("kmalloctest5: out of memory\n");
+		return ENOMEM;
+	}
+
+	/*
+	 * Fragment the heap: allocate ballast and filler alternately,
+	 * then free the filler, leaving every page about half used.
+	 */
+	nballast = 0;
+	result = 0;
+	for (i = 0; i < KM5_BATCH; i++) {
+		ballast[i] = kmalloc(km5_sizes[i % NUM_KM5_SIZES]);
+		ptrs[i] = kmalloc(km5_sizes[i % NUM_KM5_SIZES]);
+		if (ballast[i] != NULL) {
+			nballast++;
+		}
+		if (ballast[i] == NULL || ptrs[i] == NULL) {
+			kfree(ptrs[i]);
+			result = ENOMEM;
+			break;
+		}
+	}
+	while (i-- > 0) {
+		kfree(ptrs[i]);
+	}
+
+	for (mode = 0; mode < 2 && result == 0; mode++) {
+		kheap_fastfree_set(mode == 1);
+		result = km5_run(ptrs, &subns[mode], &pagens[mode]);
+	}
+	kheap_fastfree_set(true);
+
+	for (i = 0; i < nballast; i++) {
+		kfree(ballast[i]);
+	}
+	kfree(ballast);
+	kfree(ptrs);
+
+	if (result) {
+		kprintf("kmalloctest5: out of memory\n");
+		return result;
+	}
+
+	for (mode = 0; mode < 2; mode++) {
+		kprintf("km5: %-6s lookup: %u subpage frees %llu ns/free, "
+			"%u page frees %llu ns/free\n",
+			mode ? "frame" : "search",
+			KM5_ROUNDS * KM5_BATCH,
+			(unsigned long long)(subns[mode] /
+					     (KM5_ROUNDS * KM5_BATCH)),
+			KM5_NPAGES,
+			(unsigned long long)(pagens[mode] / KM5_NPAGES));
+	}
+	kprintf("km5: speedup %llu.%02llux subpage, %llu.%02llux page\n",
+		(unsigned long long)(subns[0] / (subns[1] ? subns[1] : 1)),
+		(unsigned long long)((subns[0] * 100 /
+				      (subns[1] ? subns[1] : 1)) % 100),
+		(unsigned long long)(pagens[0] / (pagens[1] ? pagens[1] : 1)),
+		(unsigned long long)((pagens[0] * 100 /
+				      (pagens[1] ? pagens[1] : 1)) % 100));
+
+	kprintf("kfree benchmark done\n");
+	return 0;
+}
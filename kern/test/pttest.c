@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Benchmarks for the page table and TLB refill.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <vm.h>
+#include <test.h>
+
+////////////////////////////////////////////////////////////
+// pt1
+
+/*
+ * Compare page table designs. Build the kernel with and without
+ * "options hpt" and run pt1 on each. The menu thread borrows a
+ * series of throwaway address spaces and touches their pages with
+ * copyout/copyin, so every access goes through vm_fault exactly as
+ * a user program's would. Three workloads are modelled on the user
+ * tests of the same names:
+ *
+ *    huge       - one process touching one word every four pages of
+ *                 a large array: first-touch faults, then refaults
+ *                 (TLB misses on resident pages), and table size.
+ *
+ *    parallelvm - several processes faulting in turn, so the tables
+ *                 of all of them are live at once.
+ *
+ *    forkbomb   - repeated as_copy/as_destroy of a small process.
+ */
+
+#define PT1_BASE        0x00400000
+#define PT1_HUGE_PAGES  256     /* pages touched */
+#define PT1_HUGE_STRIDE 4       /* one word every PT1_HUGE_STRIDE pages */
+#define PT1_NJOBS       8
+#define PT1_JOB_PAGES   32
+#define PT1_FORK_PAGES  24
+#define PT1_NFORKS      200
+
+static
+uint64_t
+pt1_nsecs(const struct timespec *before, const struct timespec *after)
+{
+	struct timespec duration;
+
+	timespec_sub(after, before, &duration);
+	return (uint64_t)duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+}
+
+/*
+ * Make an address space with one read/write region of NPAGES pages
+ * at PT1_BASE.
+ */
+static
+struct addrspace *
+pt1_mkas(unsigned npages)
+{
+	struct addrspace *as;
+
+	as = as_create();
+	if (as == NULL) {
+		return NULL;
+	}
+	if (as_define_region(as, PT1_BASE, npages * PAGE_SIZE, 1, 1, 0)) {
+		as_destroy(as);
+		return NULL;
+	}
+	return as;
+}
+
+/* Make AS current for the menu thread; returns the previous one. */
+static
+struct addrspace *
+pt1_switch(struct addrspace *as)
+{
+	struct addrspace *old;
+
+	old = proc_setas(as);
+	as_activate();
+	return old;
+}
+
+/*
+ * Touch NPAGES pages, STRIDE pages apart, writing or reading one
+ * word in each. Returns the number touched.
+ */
+static
+unsigned
+pt1_touch(unsigned npages, unsigned stride, bool write)
+{
+	userptr_t addr;
+	unsigned i;
+	int val;
+
+	for (i = 0; i < npages; i++) {
+		addr = (userptr_t)(PT1_BASE + i * stride * PAGE_SIZE);
+		val = i;
+		if (write ? copyout(&val, addr, sizeof(val)) :
+		    copyin(addr, &val, sizeof(val))) {
+			break;
+		}
+	}
+	return i;
+}
+
+static
+void
+pt1_huge(void)
+{
+	struct addrspace *as, *old;
+	struct timespec t0, t1, t2;
+	unsigned n1, n2;
+	size_t size;
+
+	as = pt1_mkas(PT1_HUGE_PAGES * PT1_HUGE_STRIDE);
+	if (as == NULL) {
+		kprintf("pt1: huge: out of memory\n");
+		return;
+	}
+	old = pt1_switch(as);
+
+	gettime(&t0);
+	n1 = pt1_touch(PT1_HUGE_PAGES, PT1_HUGE_STRIDE, true);
+	gettime(&t1);
+	/* far more pages than TLB entries, so these all miss again */
+	n2 = pt1_touch(n1, PT1_HUGE_STRIDE, false);
+	gettime(&t2);
+	size = pagetable_size(as->pagetable);
+
+	pt1_switch(old);
+	as_destroy(as);
+
+	kprintf("pt1: huge: %u pages, first touch %llu ns/fault, "
+		"refault %llu ns/fault, table %u bytes\n", n1,
+		(unsigned long long)(n1 ? pt1_nsecs(&t0, &t1) / n1 : 0),
+		(unsigned long long)(n2 ? pt1_nsecs(&t1, &t2) / n2 : 0),
+		(unsigned)size);
+}
+
+static
+void
+pt1_parallelvm(void)
+{
+	struct addrspace *jobs[PT1_NJOBS];
+	struct addrspace *old;
+	struct timespec before, after;
+	unsigned i, j, nfaults = 0;
+	size_t size = 0;
+	userptr_t addr;
+	int val;
+
+	for (i = 0; i < PT1_NJOBS; i++) {
+		jobs[i] = pt1_mkas(PT1_JOB_PAGES);
+		if (jobs[i] == NULL) {
+			kprintf("pt1: parallelvm: out of memory\n");
+			while (i-- > 0) {
+				as_destroy(jobs[i]);
+			}
+			return;
+		}
+	}
+
+	old = proc_getas();
+	gettime(&before);
+	for (j = 0; j < PT1_JOB_PAGES; j++) {
+		for (i = 0; i < PT1_NJOBS; i++) {
+			pt1_switch(jobs[i]);
+			addr = (userptr_t)(PT1_BASE + j * PAGE_SIZE);
+			val = j;
+			if (copyout(&val, addr, sizeof(val)) == 0) {
+				nfaults++;
+			}
+		}
+	}
+	gettime(&after);
+	pt1_switch(old);
+
+	for (i = 0; i < PT1_NJOBS; i++) {
+		size += pagetable_size(jobs[i]->pagetable);
+		as_destroy(jobs[i]);
+	}
+
+	kprintf("pt1: parallelvm: %u jobs, %u faults, %llu ns/fault, "
+		"tables %u bytes\n", PT1_NJOBS, nfaults,
+		(unsigned long long)(nfaults ? pt1_nsecs(&before, &after) / nfaults : 0),
+		(unsigned)size);
+}
+
+static
+void
+pt1_forkbomb(void)
+{
+	struct addrspace *parent, *child, *old;
+	struct timespec before, after;
+	unsigned i, n;
+	size_t size = 0;
+
+	parent = pt1_mkas(PT1_FORK_PAGES);
+	if (parent == NULL) {
+		kprintf("pt1: forkbomb: out of memory\n");
+		return;
+	}
+	old = pt1_switch(parent);
+	n = pt1_touch(PT1_FORK_PAGES, 1, true);
+	pt1_switch(old);
+
+	gettime(&before);
+	for (i = 0; i < PT1_NFORKS; i++) {
+		if (as_copy(parent, &child)) {
+			break;
+		}
+		if (i == 0) {
+			size = pagetable_size(child->pagetable);
+		}
+		as_destroy(child);
+	}
+	gettime(&after);
+	as_destroy(parent);
+
+	kprintf("pt1: forkbomb: %u forks of %u pages, %llu ns/fork, "
+		"child table %u bytes\n", i, n,
+		(unsigned long long)(i ? pt1_nsecs(&before, &after) / i : 0),
+		(unsigned)size);
+}
+
+////////////////////////////////////////////////////////////
+// pt2
+
+/*
+ * Cost of a TLB miss on a resident page, with the software TLB fast
+ * path in vm_fault off and then on. PT2_PAGES is far more than the
+ * TLB holds, so after the first pass every read misses again.
+ * Fault-around is switched off so each miss is a real refill.
+ */
+
+#define PT2_PAGES  256
+#define PT2_PASSES 20
+
+static
+void
+pt2_run(bool stlb)
+{
+	struct timespec before, after;
+	unsigned misses, pass, n = 0;
+	uint64_t nsecs;
+
+	vm_set_stlb(stlb);
+	misses = as_tlb_misses();
+	gettime(&before);
+	for (pass = 0; pass < PT2_PASSES; pass++) {
+		n += pt1_touch(PT2_PAGES, 1, false);
+	}
+	gettime(&after);
+	misses = as_tlb_misses() - misses;
+	nsecs = pt1_nsecs(&before, &after);
+
+	kprintf("pt2: software TLB %s: %u reads, %u misses, "
+		"%llu ns/miss\n", stlb ? "on " : "off", n, misses,
+		(unsigned long long)(misses ? nsecs / misses : 0));
+}
+
+int
+tlbtest(int nargs, char **args)
+{
+	struct addrspace *as, *old;
+	unsigned faultaround;
+	bool stlb;
+
+	(void)nargs;
+	(void)args;
+
+	as = pt1_mkas(PT2_PAGES);
+	if (as == NULL) {
+		kprintf("pt2: out of memory\n");
+		return ENOMEM;
+	}
+	faultaround = vm_get_faultaround();
+	stlb = vm_get_stlb();
+	vm_set_faultaround(0);
+
+	kprintf("Starting TLB miss benchmark...\n");
+	old = pt1_switch(as);
+	pt1_touch(PT2_PAGES, 1, true);
+	pt2_run(false);
+	pt2_run(true);
+	pt1_switch(old);
+	kprintf("TLB miss benchmark done\n");
+
+	vm_set_faultaround(faultaround);
+	vm_set_stlb(stlb);
+	as_destroy(as);
+	return 0;
+}
+
+int
+pttest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting page table benchmark (%s, %u bytes shared)...\n",
+		OPT_HPT ? "hashed" : "two-level",
+		(unsigned)pagetable_global_size());
+	pt1_huge();
+	pt1_parallelvm();
+	pt1_forkbomb();
+	kprintf("Page table benchmark done\n");
+	return 0;
+}
@@ -53,6 +53,9 @@
 #include <mainbus.h>
 #include <vnode.h>
 #include <pid.h>
+#include <slab.h>
+#include "opt-unsw.h"
+#include "opt-dumbvm.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -64,6 +67,10 @@ struct wchan {
 	struct threadlist wc_threads;	/* list of waiting threads */
 };
 
+/* Cache for struct thread. */
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread));
+
 /* Master array of CPUs. */
 DECLARRAY(cpu, static __UNUSED inline);
 DEFARRAY(cpu, static __UNUSED inline);
@@ -123,14 +130,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(&thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(&thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -196,6 +203,14 @@ cpu_create(unsigned hardware_number)
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
 
+#if OPT_UNSW
+	/* before anything on this cpu can call alloc_kpages */
+	frame_cache_init(&c->c_framecache, c->c_number);
+#endif
+#if !OPT_DUMBVM
+	cpu_tlb_init(&c->c_tlb, c->c_number);
+#endif
+
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
 	if (c->c_curthread == NULL) {
@@ -287,7 +302,7 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(&thread_cache, thread);
 }
 
 /*
@@ -1167,6 +1182,27 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to all CPUs except the current one.
+ * Returns the number of CPUs it was sent to.
+ */
+unsigned
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i, n;
+	struct cpu *c;
+
+	n = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -139,6 +139,46 @@ dev_write(struct vnode *v, struct uio *uio)
 	return DEVOP_IO(d, uio);
 }
 
+/*
+ * Submit an asynchronous request. Devices without a request queue
+ * do the I/O here, synchronously, so the request is already complete
+ * when this returns.
+ */
+int
+dev_submit(struct device *d, struct device_req *req)
+{
+	struct iovec iov;
+	struct uio ku;
+	size_t len;
+
+	if (d->d_ops->devop_submit != NULL) {
+		return d->d_ops->devop_submit(d, req);
+	}
+
+	len = (size_t)req->dr_nblocks * d->d_blocksize;
+	uio_kinit(&iov, &ku, req->dr_data, len,
+		  (off_t)req->dr_block * d->d_blocksize,
+		  req->dr_write ? UIO_WRITE : UIO_READ);
+	req->dr_result = DEVOP_IO(d, &ku);
+	req->dr_ndone = (len - ku.uio_resid) / d->d_blocksize;
+	req->dr_complete = true;
+	return 0;
+}
+
+/*
+ * Wait for a submitted request to finish and return its result.
+ */
+int
+dev_wait(struct device *d, struct device_req *req)
+{
+	if (d->d_ops->devop_wait != NULL) {
+		return d->d_ops->devop_wait(d, req);
+	}
+
+	KASSERT(req->dr_complete);
+	return req->dr_result;
+}
+
 /*
  * Called for ioctl(). Just pass through.
  */
@@ -237,15 +277,20 @@ null_fsync(struct vnode *v)
 }
 
 /*
- * For mmap. If you want this to do anything, you have to write it
- * yourself. Some devices may not make sense to map. Others do.
+ * For mmap. Devices are not mapped: the VM system pages mappings in
+ * and out a page at a time with VOP_READ/VOP_WRITE, which makes no
+ * sense for character devices, and block devices are the swap and
+ * filesystem backing stores.
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v, off_t offset, size_t len, size_t *backed)
 {
 	(void)v;
-	return ENOSYS;
+	(void)offset;
+	(void)len;
+	(void)backed;
+	return ENODEV;
 }
 
 /*
@@ -32,11 +32,17 @@
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <synch.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <proc.h>
+#include <vnode.h>
+#include <textcache.h>
+#include <slab.h>
+#include <cpu.h>
+#include <platform/maxcpus.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -48,6 +54,276 @@
  *
  */
 
+/* Regions come and go with every exec, mmap and sbrk. */
+static struct kmem_cache region_cache =
+        KMEM_CACHE_INITIALIZER("region", sizeof(region));
+
+/*
+ * TLB address space ids.
+ *
+ * User translations are tagged with an ASID so they can stay in the
+ * TLB across context switches. Each cpu hands out ids 1..NUM_ASID-1
+ * in turn; 0 is left for kernel threads and invalid entries. When a
+ * cpu runs out it flushes its TLB and starts a new generation, and an
+ * address space holding an id from an older generation is given a
+ * fresh one the next time it runs there. Nothing else flushes the
+ * whole TLB.
+ */
+
+static struct cpu_tlb *cpu_tlbs[MAXCPUS];
+
+void
+cpu_tlb_init(struct cpu_tlb *ct, unsigned cpunum)
+{
+    KASSERT(cpunum < MAXCPUS);
+    ct->ct_asid_next = 1;
+    ct->ct_asid_gen = 1;
+    ct->ct_misses = 0;
+    ct->ct_rollovers = 0;
+    ct->ct_prefetched = 0;
+    ct->ct_prefetch_wasted = 0;
+    ct->ct_stlb_hits = 0;
+    ct->ct_stlb_misses = 0;
+    cpu_tlbs[cpunum] = ct;
+}
+
+uint32_t
+as_asid(struct addrspace *as)
+{
+    struct cpu_tlb *ct = &curcpu->c_tlb;
+    unsigned n = curcpu->c_number;
+    int i;
+
+    if (as->asid_gen[n] == ct->ct_asid_gen) {
+        return as->asid[n];
+    }
+
+    if (ct->ct_asid_next == NUM_ASID) {
+        for (i=0; i<NUM_TLB; i++) {
+            tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+        }
+        ct->ct_asid_next = 1;
+        ct->ct_asid_gen++;
+        if (ct->ct_asid_gen == 0) {
+            /* 0 means "never assigned" */
+            ct->ct_asid_gen = 1;
+        }
+        ct->ct_rollovers++;
+    }
+    as->asid[n] = ct->ct_asid_next++;
+    as->asid_gen[n] = ct->ct_asid_gen;
+    return as->asid[n];
+}
+
+/*
+ * Give AS new ids on every cpu, so that whatever it has left in any
+ * TLB can no longer be matched. The old ids are not handed out again
+ * until their cpu has flushed.
+ */
+static void
+as_asid_renew(struct addrspace *as)
+{
+    for (unsigned i = 0; i < MAXCPUS; ++i) {
+        as->asid_gen[i] = 0;
+    }
+    as_stlb_flush(as);
+    if (as == proc_getas()) {
+        as_activate();
+    }
+}
+
+void
+as_stlb_flush(struct addrspace *as)
+{
+    for (unsigned i = 0; i < VM_STLB_SIZE; ++i) {
+        as->stlb[i].se_pte = NULL;
+    }
+}
+
+void
+as_tlb_invalidate(struct addrspace *as, vaddr_t vaddr)
+{
+    struct addrspace *curas = proc_getas();
+    unsigned n;
+    int spl, tlb_index;
+
+    spl = splhigh();
+    n = curcpu->c_number;
+    if (as->asid_gen[n] == curcpu->c_tlb.ct_asid_gen) {
+        tlb_index = tlb_probe(PAGE_NUM(vaddr) | (as->asid[n] << TLBHI_PIDSHIFT), 0);
+        if (tlb_index >= 0) {
+            tlb_write(TLBHI_INVALID(tlb_index), TLBLO_INVALID(), tlb_index);
+        }
+        /* put back the id of whatever is running here */
+        if (curas != NULL && curas->asid_gen[n] == curcpu->c_tlb.ct_asid_gen) {
+            tlb_setasid(curas->asid[n]);
+        }
+        else {
+            tlb_setasid(0);
+        }
+    }
+    splx(spl);
+}
+
+void
+as_tlb_printstats(void)
+{
+    for (unsigned n = 0; n < MAXCPUS; ++n) {
+        if (cpu_tlbs[n] != NULL) {
+            kprintf("cpu%u: %u TLB misses, %u ASID rollovers\n", n,
+                cpu_tlbs[n]->ct_misses, cpu_tlbs[n]->ct_rollovers);
+            kprintf("      %u prefetched, %u wasted\n",
+                cpu_tlbs[n]->ct_prefetched,
+                cpu_tlbs[n]->ct_prefetch_wasted);
+            kprintf("      software TLB: %u hits, %u misses\n",
+                cpu_tlbs[n]->ct_stlb_hits,
+                cpu_tlbs[n]->ct_stlb_misses);
+        }
+    }
+}
+
+unsigned
+as_tlb_misses(void)
+{
+    unsigned misses = 0;
+
+    for (unsigned n = 0; n < MAXCPUS; ++n) {
+        if (cpu_tlbs[n] != NULL) {
+            misses += cpu_tlbs[n]->ct_misses;
+        }
+    }
+    return misses;
+}
+
+/*
+ * Insert REGION into the sorted region array of AS, growing the
+ * array when it is full.
+ */
+static int
+as_add_region(struct addrspace *as, region_ptr new_region)
+{
+    unsigned i;
+
+    if (as->nregions == as->maxregions) {
+        unsigned newmax = as->maxregions ? as->maxregions * 2 : 4;
+        region_ptr *newregions = kmalloc(newmax * sizeof(region_ptr));
+        if (newregions == NULL) {
+            return ENOMEM;
+        }
+        for (i = 0; i < as->nregions; ++i) {
+            newregions[i] = as->regions[i];
+        }
+        kfree(as->regions);
+        as->regions = newregions;
+        as->maxregions = newmax;
+    }
+
+    i = as->nregions;
+    while (i > 0 && as->regions[i-1]->base > new_region->base) {
+        as->regions[i] = as->regions[i-1];
+        --i;
+    }
+    as->regions[i] = new_region;
+    as->nregions++;
+    return 0;
+}
+
+/*
+ * Take REGION out of the region array of AS. Doesn't free it.
+ */
+static void
+as_remove_region(struct addrspace *as, region_ptr old_region)
+{
+    unsigned i;
+
+    for (i = 0; i < as->nregions; ++i) {
+        if (as->regions[i] == old_region) {
+            break;
+        }
+    }
+    KASSERT(i < as->nregions);
+    for (; i + 1 < as->nregions; ++i) {
+        as->regions[i] = as->regions[i+1];
+    }
+    as->nregions--;
+    if (as->last_region == old_region) {
+        as->last_region = NULL;
+    }
+}
+
+region_ptr
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+    region_ptr found = as->last_region;
+    unsigned low, high, mid;
+
+    if (found != NULL &&
+        vaddr >= found->base && vaddr < found->base + found->size
+    ){
+        return found;
+    }
+
+    /* find the last region starting at or below vaddr */
+    low = 0;
+    high = as->nregions;
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (as->regions[mid]->base <= vaddr) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    if (low == 0) {
+        return NULL;
+    }
+    found = as->regions[low-1];
+    if (vaddr >= found->base + found->size) {
+        return NULL;
+    }
+    as->last_region = found;
+    return found;
+}
+
+/*
+ * Lowest address region R may come to occupy. For the stack that is
+ * its growth limit less the guard gap, which sbrk and mmap keep out of.
+ */
+static vaddr_t
+as_region_floor(struct addrspace *as, region_ptr r)
+{
+    if (r == as->stack) {
+        return VM_STACK_FLOOR - VM_STACK_GUARD_PAGES * PAGE_SIZE;
+    }
+    return r->base;
+}
+
+region_ptr
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+    region_ptr stack = as->stack;
+    vaddr_t base = PAGE_NUM(vaddr);
+    unsigned i;
+
+    if (stack == NULL || vaddr >= stack->base || base < VM_STACK_FLOOR) {
+        return NULL;
+    }
+
+    /* keep the guard gap to whatever lies below, even if exec put it there */
+    for (i = 0; as->regions[i] != stack; ++i);
+    if (i > 0 && as->regions[i-1]->base + as->regions[i-1]->size +
+        VM_STACK_GUARD_PAGES * PAGE_SIZE > base
+    ){
+        return NULL;
+    }
+
+    stack->size += stack->base - base;
+    stack->npages = stack->size / PAGE_SIZE;
+    stack->base = base;
+    return stack;
+}
+
 struct addrspace *
 as_create(void)
 {
@@ -62,17 +338,30 @@ as_create(void)
        * Initialize as needed.
        */
 
-    as->region_start = NULL;
+    as->regions = NULL;
+    as->nregions = 0;
+    as->maxregions = 0;
+    as->last_region = NULL;
+    as->heap = NULL;
+    as->heap_brk = 0;
+    as->stack = NULL;
+    for (unsigned i = 0; i < MAXCPUS; ++i) {
+        as->asid[i] = 0;
+        as->asid_gen[i] = 0;
+    }
+    as_stlb_flush(as);
       
+    as->as_lock = lock_create("as");
+    if(as->as_lock == NULL){
+        kfree(as);
+        return NULL;
+    }
     as->pagetable = pagetable_create_l1();
     if(as->pagetable == NULL){
+        lock_destroy(as->as_lock);
         kfree(as);
         return NULL;
     }
-    
-    for (uint16_t i = 0; i < L1_PAGETABLE_NUM; ++i) {
-        as->pagetable[i] = NULL;
-    }
 
       return as;
 }
@@ -91,14 +380,23 @@ as_copy(struct addrspace *old, struct addrspace **ret)
        * Write this.
        */
     
+    lock_acquire(old->as_lock);
     if(pagetable_copy(old->pagetable, newas->pagetable)){
+        lock_release(old->as_lock);
         as_destroy(newas);
         return ENOMEM;
     }
-    region_ptr oldRegionPtr = old->region_start;
-    while(oldRegionPtr){
-        region_ptr newNode = kmalloc(sizeof(region));
+
+    /*
+     * The parent's pages are now copy-on-write; drop any writable
+     * translations it still has cached in the TLB.
+     */
+    as_asid_renew(old);
+    for(unsigned i = 0; i < old->nregions; ++i){
+        region_ptr oldRegionPtr = old->regions[i];
+        region_ptr newNode = kmem_cache_alloc(&region_cache);
         if (!newNode){
+            lock_release(old->as_lock);
             as_destroy(newas);
             return ENOMEM;
         }
@@ -106,11 +404,33 @@ as_copy(struct addrspace *old, struct addrspace **ret)
         newNode->npages = oldRegionPtr->npages;
         newNode->permission = oldRegionPtr->permission;
         newNode->size = oldRegionPtr->size;
-        newNode->next = newas->region_start;
-        newas->region_start = newNode;
-
-        oldRegionPtr = oldRegionPtr->next;
+        newNode->vnode = oldRegionPtr->vnode;
+        newNode->mapped = oldRegionPtr->mapped;
+        newNode->file_offset = oldRegionPtr->file_offset;
+        newNode->file_vaddr = oldRegionPtr->file_vaddr;
+        newNode->file_size = oldRegionPtr->file_size;
+        if(newNode->vnode){
+            VOP_INCREF(newNode->vnode);
+        }
+        /* already in order, so this just appends */
+        if(as_add_region(newas, newNode)){
+            if(newNode->vnode){
+                VOP_DECREF(newNode->vnode);
+            }
+            kmem_cache_free(&region_cache, newNode);
+            lock_release(old->as_lock);
+            as_destroy(newas);
+            return ENOMEM;
+        }
+        if(oldRegionPtr == old->heap){
+            newas->heap = newNode;
+        }
+        if(oldRegionPtr == old->stack){
+            newas->stack = newNode;
+        }
     }
+    newas->heap_brk = old->heap_brk;
+    lock_release(old->as_lock);
     
       *ret = newas;
       return 0;
@@ -127,22 +447,36 @@ as_destroy(struct addrspace *as)
         return;
     }
 
+    /* mappings outlive the process; nowhere to report errors though */
+    for (unsigned i = 0; i < as->nregions; ++i) {
+        region_ptr current = as->regions[i];
+        if (current->mapped) {
+            (void)pagetable_writeback(as->pagetable, current->base,
+                current->file_size, current->vnode, current->file_offset);
+        }
+    }
+
     pagetable_destroy(as->pagetable);
+    /* shared text pages we were the last user of were released above */
+    textcache_reap();
 
-      region_ptr current = as->region_start;
-    while (current != NULL) {
-        region_ptr temp = current;
-        current = current->next;
-        kfree(temp);
+    for (unsigned i = 0; i < as->nregions; ++i) {
+        region_ptr temp = as->regions[i];
+        if(temp->vnode){
+            VOP_DECREF(temp->vnode);
+        }
+        kmem_cache_free(&region_cache, temp);
     }
+    kfree(as->regions);
 
+    lock_destroy(as->as_lock);
       kfree(as);
 }
 
 void
 as_activate(void)
 {
-      int i, spl;
+      int spl;
       struct addrspace *as;
 
       as = proc_getas();
@@ -150,12 +484,13 @@ as_activate(void)
             return;
       }
 
-      /* Disable interrupts on this CPU while frobbing the TLB. */
+      /*
+       * Disable interrupts on this CPU while frobbing the TLB.
+       * Entries of other address spaces stay; they carry other ids.
+       */
       spl = splhigh();
 
-      for (i=0; i<NUM_TLB; i++) {
-            tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-      }
+      tlb_setasid(as_asid(as));
 
       splx(spl);
 }
@@ -198,7 +533,7 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
     npages = memsize / PAGE_SIZE;
 
     if (vaddr + memsize >= USERSTACK) return ENOMEM;
-    region_ptr new_region = kmalloc(sizeof(region));
+    region_ptr new_region = kmem_cache_alloc(&region_cache);
     if (new_region == NULL) return ENOMEM;
 
     new_region->base = vaddr;
@@ -211,9 +546,13 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
     if (writeable) SET_FLAG(permission, FLAG_WRITE);
     if (executable) SET_FLAG(permission, FLAG_EXECUTE);
     new_region->permission = REGION_PERMISSION(permission);
+    new_region->vnode = NULL;
+    new_region->mapped = false;
 
-    new_region->next = as->region_start;
-    as->region_start = new_region;
+    if (as_add_region(as, new_region)) {
+        kmem_cache_free(&region_cache, new_region);
+        return ENOMEM;
+    }
 
     return 0;
 
@@ -226,6 +565,31 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
       // return ENOSYS; /* Unimplemented */
 }
 
+/*
+ * Back the region containing VADDR with FILESIZE bytes of V starting
+ * at OFFSET; the file data is mapped at VADDR. Nothing is read here,
+ * vm_fault loads each page when it is first touched. The region keeps
+ * a reference to V for as long as it exists.
+ */
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+             off_t offset, size_t filesize)
+{
+    if (as == NULL) return EINVAL;
+
+    region_ptr current = as_find_region(as, vaddr);
+    if (current == NULL || current->vnode != NULL) return EINVAL;
+    if (vaddr + filesize > current->base + current->size) return ENOEXEC;
+
+    VOP_INCREF(v);
+    current->vnode = v;
+    current->file_offset = offset;
+    current->file_vaddr = vaddr;
+    current->file_size = filesize;
+
+    return 0;
+}
+
 int
 as_prepare_load(struct addrspace *as)
 {
@@ -236,10 +600,8 @@ as_prepare_load(struct addrspace *as)
       if (as == NULL) {
         return EFAULT;
     }
-    region_ptr current = as->region_start;
-    while (current != NULL) {
-        SET_FLAG(current->permission, FLAG_WRITE);
-        current = current->next;
+    for (unsigned i = 0; i < as->nregions; ++i) {
+        SET_FLAG(as->regions[i]->permission, FLAG_WRITE);
     }
 
       return 0;
@@ -254,22 +616,257 @@ as_complete_load(struct addrspace *as)
     if (as == NULL){
         return EFAULT;
     }
-    region_ptr current = as->region_start;
-    while (current != NULL) {
+    for (unsigned i = 0; i < as->nregions; ++i) {
+        region_ptr current = as->regions[i];
         uint32_t permission = current->permission;
         if(OLD_PERMISSION(permission) != CURR_PERMISSION(permission)){
-            current->permission = REGION_PERMISSION(permission);
+            current->permission = REGION_PERMISSION(OLD_PERMISSION(permission));
         }
-        current = current->next;
     }
-      int spl = splhigh();
-    for(uint16_t i = 0; i<NUM_TLB; ++i){
-        tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+    /* forget any translations made while the regions were writable */
+    as_asid_renew(as);
+
+    /* start the heap, empty, just above the highest segment */
+    vaddr_t heap_base = 0;
+    for (unsigned i = 0; i < as->nregions; ++i) {
+        region_ptr current = as->regions[i];
+        if (current->base + current->size > heap_base) {
+            heap_base = current->base + current->size;
+        }
     }
-    splx(spl);
+    region_ptr heap = kmem_cache_alloc(&region_cache);
+    if (heap == NULL) {
+        return ENOMEM;
+    }
+    heap->base = heap_base;
+    heap->size = 0;
+    heap->npages = 0;
+    heap->permission = REGION_PERMISSION(FLAG_READ | FLAG_WRITE);
+    heap->vnode = NULL;
+    heap->mapped = false;
+    if (as_add_region(as, heap)) {
+        kmem_cache_free(&region_cache, heap);
+        return ENOMEM;
+    }
+    as->heap = heap;
+    as->heap_brk = heap_base;
+
       return 0;
 }
 
+static int
+as_dosbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbrk)
+{
+    region_ptr heap = as->heap;
+    vaddr_t newbrk, newtop, limit;
+
+    if (amount < 0 && (vaddr_t)0 - (vaddr_t)amount > as->heap_brk - heap->base) {
+        return EINVAL;
+    }
+    if (amount > 0 && (vaddr_t)amount > USERSPACETOP - as->heap_brk) {
+        return ENOMEM;
+    }
+    newbrk = as->heap_brk + amount;
+    newtop = PAGE_NUM((newbrk + PAGE_SIZE - 1));
+
+    /* the heap may grow up to the next region above it */
+    limit = USERSPACETOP;
+    for (unsigned i = 0; i < as->nregions; ++i) {
+        region_ptr current = as->regions[i];
+        if (current != heap && current->base >= heap->base &&
+            as_region_floor(as, current) < limit
+        ){
+            limit = as_region_floor(as, current);
+        }
+    }
+    if (newtop > limit) {
+        return ENOMEM;
+    }
+
+    if (newtop < heap->base + heap->size) {
+        pagetable_unmap(as->pagetable, newtop, heap->base + heap->size);
+        /* the pages may still be in this or another cpu's TLB */
+        as_asid_renew(as);
+    }
+    heap->size = newtop - heap->base;
+    heap->npages = heap->size / PAGE_SIZE;
+
+    *oldbrk = as->heap_brk;
+    as->heap_brk = newbrk;
+    return 0;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbrk)
+{
+    int result;
+
+    if (as == NULL || as->heap == NULL) {
+        return EFAULT;
+    }
+    lock_acquire(as->as_lock);
+    result = as_dosbrk(as, amount, oldbrk);
+    lock_release(as->as_lock);
+    return result;
+}
+
+/*
+ * Mappings go in the highest gap between regions that fits, which
+ * is normally just below the stack; that leaves the heap as much
+ * room as possible to grow up towards them.
+ */
+static int
+as_domap(struct addrspace *as, size_t len, int prot, struct vnode *v,
+         off_t offset, size_t backed, vaddr_t *addr)
+{
+    vaddr_t lo, hi, base = 0;
+    size_t size;
+    unsigned i;
+
+    size = PAGE_NUM((len + PAGE_SIZE - 1));
+    for (i = as->nregions; i > 0; --i) {
+        lo = as->regions[i-1]->base + as->regions[i-1]->size;
+        hi = i < as->nregions ?
+            as_region_floor(as, as->regions[i]) : USERSPACETOP;
+        if (hi >= lo && hi - lo >= size) {
+            base = hi - size;
+            break;
+        }
+    }
+    if (i == 0) return ENOMEM;
+
+    region_ptr new_region = kmem_cache_alloc(&region_cache);
+    if (new_region == NULL) return ENOMEM;
+
+    uint32_t permission = 0;
+    if (prot & PROT_READ) SET_FLAG(permission, FLAG_READ);
+    if (prot & PROT_WRITE) SET_FLAG(permission, FLAG_WRITE);
+
+    new_region->base = base;
+    new_region->size = size;
+    new_region->npages = size / PAGE_SIZE;
+    new_region->permission = REGION_PERMISSION(permission);
+    new_region->vnode = v;
+    new_region->file_offset = offset;
+    new_region->file_vaddr = base;
+    new_region->file_size = backed;
+    new_region->mapped = true;
+
+    if (as_add_region(as, new_region)) {
+        kmem_cache_free(&region_cache, new_region);
+        return ENOMEM;
+    }
+    VOP_INCREF(v);
+
+    *addr = base;
+    return 0;
+}
+
+int
+as_mmap(struct addrspace *as, size_t len, int prot, struct vnode *v,
+        off_t offset, size_t backed, vaddr_t *addr)
+{
+    int result;
+
+    if (as == NULL) return EINVAL;
+    if (len == 0 || len > USERSPACETOP) return EINVAL;
+
+    lock_acquire(as->as_lock);
+    result = as_domap(as, len, prot, v, offset, backed, addr);
+    lock_release(as->as_lock);
+    return result;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr)
+{
+    region_ptr current;
+    int result;
+
+    if (as == NULL) return EINVAL;
+
+    lock_acquire(as->as_lock);
+    current = as_find_region(as, addr);
+    if (current == NULL || !current->mapped || current->base != addr) {
+        lock_release(as->as_lock);
+        return EINVAL;
+    }
+
+    /* not across the writes; the file system may be waiting on a fault */
+    lock_release(as->as_lock);
+    result = pagetable_writeback(as->pagetable, current->base,
+        current->file_size, current->vnode, current->file_offset);
+    lock_acquire(as->as_lock);
+
+    /* unmap even if the writeback failed; there's no retrying it */
+    pagetable_unmap(as->pagetable, current->base,
+        current->base + current->size);
+    as_asid_renew(as);
+
+    as_remove_region(as, current);
+    lock_release(as->as_lock);
+
+    VOP_DECREF(current->vnode);
+    kmem_cache_free(&region_cache, current);
+
+    return result;
+}
+
+int
+as_sync_vnode(struct addrspace *as, struct vnode *v)
+{
+    region_ptr current, next;
+    vaddr_t base, from = 0;
+    size_t file_size;
+    off_t file_offset;
+    bool synced = false;
+    int result = 0, err;
+
+    if (as == NULL) return 0;
+
+    /*
+     * One mapping at a time, in address order: note it under as_lock,
+     * then write it back without the lock (see as_munmap). The caller's
+     * file reference keeps V alive meanwhile.
+     */
+    lock_acquire(as->as_lock);
+    while (1) {
+        next = NULL;
+        for (unsigned i = 0; i < as->nregions; ++i) {
+            current = as->regions[i];
+            if (current->mapped && current->vnode == v &&
+                current->base >= from &&
+                (next == NULL || current->base < next->base)
+            ) {
+                next = current;
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+        base = next->base;
+        file_size = next->file_size;
+        file_offset = next->file_offset;
+        from = base + next->size;
+        lock_release(as->as_lock);
+
+        err = pagetable_writeback(as->pagetable, base, file_size, v,
+            file_offset);
+        if (err && !result) {
+            result = err;
+        }
+        synced = true;
+
+        lock_acquire(as->as_lock);
+    }
+    /* pages written back are read-only again; drop writable entries */
+    if (synced) {
+        as_asid_renew(as);
+    }
+    lock_release(as->as_lock);
+    return result;
+}
+
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
@@ -282,14 +879,14 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
     }
 
     vaddr_t stacktop = USERSTACK;
-    size_t npages = 16;
+    size_t npages = 1;
     size_t stacksize = npages*PAGE_SIZE;
     vaddr_t stackbase = stacktop - stacksize;
     uint32_t permission = 0;
 
     stackbase = PAGE_NUM(stackbase);
 
-    struct region *new_stack_region = kmalloc(sizeof(struct region));
+    struct region *new_stack_region = kmem_cache_alloc(&region_cache);
     if (new_stack_region == NULL) {
         return ENOMEM; 
     }
@@ -299,10 +896,15 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
     new_stack_region->npages = npages;
     SET_FLAG(permission, FLAG_READ);
     SET_FLAG(permission, FLAG_WRITE);
-    new_stack_region->permission = REGION_PERMISSION(permission);; 
-    new_stack_region->next = as->region_start;
+    new_stack_region->permission = REGION_PERMISSION(permission);
+    new_stack_region->vnode = NULL;
+    new_stack_region->mapped = false;
 
-    as->region_start = new_stack_region;
+    if (as_add_region(as, new_stack_region)) {
+        kmem_cache_free(&region_cache, new_stack_region);
+        return ENOMEM;
+    }
+    as->stack = new_stack_region;
 
     *stackptr = USERSTACK;
 
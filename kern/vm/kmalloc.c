@@ -31,6 +31,8 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <vm.h>
+#include <slab.h>
+#include "opt-unsw.h"
 
 /*
  * Kernel malloc.
@@ -73,6 +75,11 @@ fill_deadbeef(void *vptr, size_t len)
 //    more blocks would fit on a page than with the existing block
 //    sizes, and large numbers of items of the new size are allocated.
 //
+//    Blocks bigger than half a page would waste the rest of their page,
+//    so those size classes are carved from spans of several contiguous
+//    pages instead (spanpages[]); e.g. four 3072-byte blocks share
+//    three pages. Everything below still says "page" for a span.
+//
 //    The free counts and addresses of the pages are maintained in
 //    another list.  Maintaining this table is a nuisance, because it
 //    cannot recursively use the subpage allocator. (We could probably
@@ -125,11 +132,14 @@ fill_deadbeef(void *vptr, size_t len)
 
 #if PAGE_SIZE == 4096
 
-#define NSIZES 8
-static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+#define NSIZES 10
+static const size_t sizes[NSIZES] =
+	{ 16, 32, 64, 128, 256, 512, 1024, 2048, 3072, 6144 };
+static const unsigned spanpages[NSIZES] =
+	{ 1, 1, 1, 1, 1, 1, 1, 1, 3, 3 };
 
 #define SMALLEST_SUBPAGE_SIZE 16
-#define LARGEST_SUBPAGE_SIZE 2048
+#define LARGEST_SUBPAGE_SIZE 6144
 
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
@@ -137,6 +147,8 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #error "Odd page size"
 #endif
 
+#define SPAN_SIZE(blktype) (spanpages[blktype] * PAGE_SIZE)
+
 ////////////////////////////////////////
 
 struct freelist {
@@ -168,6 +180,25 @@ struct pageref {
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+/*
+ * With the UNSW frame table each subpage page is tagged with its
+ * pageref (see frame_set_owner), so subpage_kfree need not search
+ * allbase. The search is kept for other configurations and for
+ * comparison.
+ */
+#if OPT_UNSW
+static bool subpage_fastfree = true;
+#endif
+
+/*
+ * Allocations since boot and the bytes asked for and handed out, by
+ * size class; the extra last entry counts whole-page allocations.
+ * Protected by kmalloc_spinlock.
+ */
+static unsigned kh_nallocs[NSIZES + 1];
+static uint64_t kh_requested[NSIZES + 1];
+static uint64_t kh_granted[NSIZES + 1];
+
 ////////////////////////////////////////
 
 /*
@@ -531,7 +562,7 @@ checksubpage(struct pageref *pr)
 	KASSERT(prpage < MIPS_KSEG1);
 #endif
 
-	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	KASSERT(pr->freelist_offset < SPAN_SIZE(blktype));
 	KASSERT(pr->freelist_offset % blocksize == 0);
 
 	fla = prpage + pr->freelist_offset;
@@ -539,7 +570,7 @@ checksubpage(struct pageref *pr)
 
 	for (; fl != NULL; fl = fl->next) {
 		fla = (vaddr_t)fl;
-		KASSERT(fla >= prpage && fla < prpage + PAGE_SIZE);
+		KASSERT(fla >= prpage && fla < prpage + SPAN_SIZE(blktype));
 		KASSERT((fla-prpage) % blocksize == 0);
 #ifdef CHECKBEEF
 		checkdeadbeef(fl, blocksize);
@@ -556,7 +587,7 @@ checksubpage(struct pageref *pr)
 	KASSERT(nfree==pr->nfree);
 
 #ifdef CHECKGUARDS
-	numblocks = PAGE_SIZE / blocksize;
+	numblocks = SPAN_SIZE(blktype) / blocksize;
 	for (i=0; i<numblocks; i++) {
 		mask = 1U << (i % 32);
 		if ((isfree[i / 32] & mask) == 0) {
@@ -640,7 +671,7 @@ void
 dump_subpage(struct pageref *pr, unsigned generation)
 {
 	unsigned blocksize = sizes[PR_BLOCKTYPE(pr)];
-	unsigned numblocks = PAGE_SIZE / blocksize;
+	unsigned numblocks = SPAN_SIZE(PR_BLOCKTYPE(pr)) / blocksize;
 	unsigned numfreewords = DIVROUNDUP(numblocks, 32);
 	uint32_t isfree[numfreewords], mask;
 	vaddr_t prpage;
@@ -765,7 +796,7 @@ subpage_stats(struct pageref *pr)
 	KASSERT(blktype >= 0 && blktype < NSIZES);
 
 	/* compute how many bits we need in freemap and assert we fit */
-	n = PAGE_SIZE / sizes[blktype];
+	n = SPAN_SIZE(blktype) / sizes[blktype];
 	KASSERT(n <= 32 * ARRAYCOUNT(freemap));
 
 	if (pr->freelist_offset != INVALID_OFFSET) {
@@ -794,6 +825,56 @@ subpage_stats(struct pageref *pr)
 	kprintf("\n");
 }
 
+/*
+ * Print a summary per size class: the spans held and how full they
+ * are now, and how much rounding up has cost since boot.
+ */
+static
+void
+kheap_classstats(void)
+{
+	struct pageref *pr;
+	unsigned i, nspans, nblocks, nfree, totpages;
+	uint64_t totreq, totgranted;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	kprintf("Size classes:\n");
+	kprintf("  %5s %4s %5s %13s %8s %10s %10s\n", "size", "span",
+		"pages", "used/total", "allocs", "requested", "granted");
+
+	totpages = 0;
+	totreq = totgranted = 0;
+	for (i=0; i<=NSIZES; i++) {
+		totreq += kh_requested[i];
+		totgranted += kh_granted[i];
+		if (i == NSIZES) {
+			kprintf("  %5s %4s %5s %13s %8u %10llu %10llu\n",
+				"pages", "-", "-", "-", kh_nallocs[i],
+				(unsigned long long)kh_requested[i],
+				(unsigned long long)kh_granted[i]);
+			break;
+		}
+
+		nspans = nfree = 0;
+		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+			nspans++;
+			nfree += pr->nfree;
+		}
+		nblocks = nspans * (SPAN_SIZE(i) / sizes[i]);
+		totpages += nspans * spanpages[i];
+		kprintf("  %5lu %4u %5u %6u/%-6u %8u %10llu %10llu\n",
+			(unsigned long)sizes[i], spanpages[i],
+			nspans * spanpages[i], nblocks - nfree, nblocks,
+			kh_nallocs[i], (unsigned long long)kh_requested[i],
+			(unsigned long long)kh_granted[i]);
+	}
+	kprintf("Subpage pages in use: %u; rounding overhead since boot: "
+		"%llu of %llu bytes\n", totpages,
+		(unsigned long long)(totgranted - totreq),
+		(unsigned long long)totgranted);
+}
+
 /*
  * Print the whole heap.
  */
@@ -811,7 +892,25 @@ kheap_printstats(void)
 		subpage_stats(pr);
 	}
 
+	kheap_classstats();
+
 	spinlock_release(&kmalloc_spinlock);
+
+	kmem_printstats();
+}
+
+////////////////////////////////////////
+
+void
+kheap_fastfree_set(bool on)
+{
+#if OPT_UNSW
+	spinlock_acquire(&kmalloc_spinlock);
+	subpage_fastfree = on;
+	spinlock_release(&kmalloc_spinlock);
+#else
+	(void)on;
+#endif
 }
 
 ////////////////////////////////////////
@@ -866,6 +965,22 @@ int blocktype(size_t clientsz)
 	return 0;
 }
 
+#if OPT_UNSW
+/*
+ * Tag every page of the span at PRPAGE in the frame table.
+ */
+static
+void
+subpage_setowner(vaddr_t prpage, int blktype, unsigned type, void *owner)
+{
+	unsigned i;
+
+	for (i=0; i<spanpages[blktype]; i++) {
+		frame_set_owner(prpage + i*PAGE_SIZE, type, owner);
+	}
+}
+#endif
+
 /*
  * Allocate a block of size SZ, where SZ is not large enough to
  * warrant a whole-page allocation.
@@ -879,6 +994,7 @@ subpage_kmalloc(size_t sz
 	)
 {
 	unsigned blktype;	// index into sizes[] that we're using
+	size_t reqsz = sz;	// what the caller asked for
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
@@ -921,7 +1037,7 @@ subpage_kmalloc(size_t sz
 
 		doalloc: /* comes here after getting a whole fresh page */
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
+			KASSERT(pr->freelist_offset < SPAN_SIZE(blktype));
 			prpage = PR_PAGEADDR(pr);
 			fla = prpage + pr->freelist_offset;
 			fl = (struct freelist *)fla;
@@ -933,7 +1049,7 @@ subpage_kmalloc(size_t sz
 			if (fl != NULL) {
 				KASSERT(pr->nfree > 0);
 				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
+				KASSERT(fla - prpage < SPAN_SIZE(blktype));
 				pr->freelist_offset = fla - prpage;
 			}
 			else {
@@ -946,6 +1062,9 @@ subpage_kmalloc(size_t sz
 #ifdef LABELS
 			retptr = establishlabel(retptr, label);
 #endif
+			kh_nallocs[blktype]++;
+			kh_requested[blktype] += reqsz;
+			kh_granted[blktype] += sizes[blktype];
 
 			checksubpages();
 
@@ -964,7 +1083,7 @@ subpage_kmalloc(size_t sz
 	 */
 
 	spinlock_release(&kmalloc_spinlock);
-	prpage = alloc_kpages(1);
+	prpage = alloc_kpages(spanpages[blktype]);
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
@@ -973,7 +1092,7 @@ subpage_kmalloc(size_t sz
 	KASSERT(prpage % PAGE_SIZE == 0);
 #ifdef CHECKBEEF
 	/* deadbeef the whole page, as it probably starts zeroed */
-	fill_deadbeef((void *)prpage, PAGE_SIZE);
+	fill_deadbeef((void *)prpage, SPAN_SIZE(blktype));
 #endif
 	spinlock_acquire(&kmalloc_spinlock);
 
@@ -987,7 +1106,7 @@ subpage_kmalloc(size_t sz
 	}
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
-	pr->nfree = PAGE_SIZE / sizes[blktype];
+	pr->nfree = SPAN_SIZE(blktype) / sizes[blktype];
 
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
@@ -1013,10 +1132,58 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
+#if OPT_UNSW
+	subpage_setowner(prpage, blktype, FRAME_OWNER_SUBPAGE, pr);
+#endif
+
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
 
+/*
+ * Find the pageref for the heap page holding PTRADDR, or NULL if it
+ * is not a subpage page. Caller holds kmalloc_spinlock.
+ */
+static
+struct pageref *
+subpage_findpage(vaddr_t ptraddr)
+{
+	struct pageref *pr;
+	vaddr_t prpage;
+	int blktype;
+
+#if OPT_UNSW
+	if (subpage_fastfree) {
+		unsigned type;
+
+		pr = frame_get_owner(ptraddr, &type);
+		if (type != FRAME_OWNER_SUBPAGE) {
+			return NULL;
+		}
+		KASSERT(PR_BLOCKTYPE(pr) < NSIZES);
+		KASSERT(ptraddr >= PR_PAGEADDR(pr) &&
+			ptraddr < PR_PAGEADDR(pr) + SPAN_SIZE(PR_BLOCKTYPE(pr)));
+		checksubpage(pr);
+		return pr;
+	}
+#endif
+
+	for (pr = allbase; pr; pr = pr->next_all) {
+		prpage = PR_PAGEADDR(pr);
+		blktype = PR_BLOCKTYPE(pr);
+		KASSERT(blktype >= 0 && blktype < NSIZES);
+
+		/* check for corruption */
+		KASSERT(blktype>=0 && blktype<NSIZES);
+		checksubpage(pr);
+
+		if (ptraddr >= prpage && ptraddr < prpage + SPAN_SIZE(blktype)) {
+			return pr;
+		}
+	}
+	return NULL;
+}
+
 /*
  * Free a pointer previously returned from subpage_kmalloc. If the
  * pointer is not on any heap page we recognize, return -1.
@@ -1065,34 +1232,19 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = subpage_findpage(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
 
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+	if (offset >= SPAN_SIZE(blktype) || offset % sizes[blktype] != 0) {
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
 
@@ -1137,11 +1289,14 @@ subpage_kfree(void *ptr)
 	pr->freelist_offset = offset;
 	pr->nfree++;
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+	KASSERT(pr->nfree <= SPAN_SIZE(blktype) / sizes[blktype]);
+	if (pr->nfree == SPAN_SIZE(blktype) / sizes[blktype]) {
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
 		freepageref(pr);
+#if OPT_UNSW
+		subpage_setowner(prpage, blktype, FRAME_OWNER_NONE, NULL);
+#endif
 		/* Call free_kpages without kmalloc_spinlock. */
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
@@ -1182,8 +1337,13 @@ kmalloc(size_t sz)
 #endif /* __GNUC__ */
 #endif /* LABELS */
 
+	/*
+	 * Use whole pages if the block would be no smaller than that
+	 * anyway, e.g. for 3073 to 4096 bytes.
+	 */
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
-	if (checksz >= LARGEST_SUBPAGE_SIZE) {
+	if (checksz > LARGEST_SUBPAGE_SIZE ||
+	    sizes[blocktype(checksz)] >= ROUNDUP(checksz, PAGE_SIZE)) {
 		unsigned long npages;
 		vaddr_t address;
 
@@ -1195,6 +1355,12 @@ kmalloc(size_t sz)
 		}
 		KASSERT(address % PAGE_SIZE == 0);
 
+		spinlock_acquire(&kmalloc_spinlock);
+		kh_nallocs[NSIZES]++;
+		kh_requested[NSIZES] += sz;
+		kh_granted[NSIZES] += npages * PAGE_SIZE;
+		spinlock_release(&kmalloc_spinlock);
+
 		return (void *)address;
 	}
 
@@ -1212,10 +1378,14 @@ void
 kfree(void *ptr)
 {
 	/*
-	 * Try subpage first; if that fails, assume it's a big allocation.
+	 * Slab objects are recognized in constant time, so check them
+	 * first. Then try subpage; if that fails, assume it's a big
+	 * allocation.
 	 */
 	if (ptr == NULL) {
 		return;
+	} else if (kmem_kfree(ptr) == 0) {
+		return;
 	} else if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Slab allocator: typed object caches with per-cpu magazines.
+ *
+ * A slab is one page from alloc_kpages(1), with a struct slab at the
+ * front and the rest cut into objects of the cache's size. Free
+ * objects are chained through their first word. The cache keeps the
+ * slabs that still have free objects on kc_partial; full slabs are
+ * not on any list and come back onto it when an object is freed.
+ * Every slab page is tagged in the frame table, so the slab (and so
+ * the cache) of any object is found from its address in O(1).
+ *
+ * In front of the slabs each cpu has a magazine of free objects per
+ * cache. It is only touched by its own cpu with interrupts off, so
+ * the common alloc and free take no lock. An empty magazine is
+ * refilled with half a magazine from the slabs, and a full one gives
+ * half back, under kc_lock.
+ *
+ * A slab that becomes completely free is returned to the page
+ * allocator, unless it is the only one with free objects left.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <slab.h>
+#include "opt-unsw.h"
+
+/* All caches used so far, for kmem_printstats. */
+static struct spinlock kmem_list_lock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kmem_caches;
+
+/*
+ * Finish setting up a statically initialized cache the first time it
+ * is used.
+ */
+static
+void
+kmem_cache_setup(struct kmem_cache *kc)
+{
+	spinlock_acquire(&kmem_list_lock);
+	if (!kc->kc_listed) {
+		if (kc->kc_size < sizeof(void *)) {
+			kc->kc_size = sizeof(void *);
+		}
+		kc->kc_size = ROUNDUP(kc->kc_size, 8);
+		kc->kc_next = kmem_caches;
+		kmem_caches = kc;
+		kc->kc_listed = true;
+	}
+	spinlock_release(&kmem_list_lock);
+}
+
+#if OPT_UNSW
+
+struct slab {
+	struct kmem_cache *sl_cache;	/* owning cache */
+	struct slab *sl_next;		/* links on kc_partial */
+	struct slab *sl_prev;
+	void *sl_free;			/* free objects in this slab */
+	unsigned sl_inuse;		/* objects handed out */
+};
+
+#define SLAB_HDRSIZE ROUNDUP(sizeof(struct slab), 8)
+
+static
+void
+slab_link(struct kmem_cache *kc, struct slab *sl)
+{
+	sl->sl_prev = NULL;
+	sl->sl_next = kc->kc_partial;
+	if (kc->kc_partial != NULL) {
+		kc->kc_partial->sl_prev = sl;
+	}
+	kc->kc_partial = sl;
+}
+
+static
+void
+slab_unlink(struct kmem_cache *kc, struct slab *sl)
+{
+	if (sl->sl_prev != NULL) {
+		sl->sl_prev->sl_next = sl->sl_next;
+	}
+	else {
+		KASSERT(kc->kc_partial == sl);
+		kc->kc_partial = sl->sl_next;
+	}
+	if (sl->sl_next != NULL) {
+		sl->sl_next->sl_prev = sl->sl_prev;
+	}
+	sl->sl_next = sl->sl_prev = NULL;
+}
+
+/*
+ * Get a fresh page and carve it up. Called without kc_lock.
+ */
+static
+struct slab *
+slab_create(struct kmem_cache *kc)
+{
+	struct slab *sl;
+	vaddr_t page, obj;
+	void **prevp;
+
+	KASSERT(kc->kc_size <= (PAGE_SIZE - SLAB_HDRSIZE) / 2);
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+	sl = (struct slab *)page;
+	sl->sl_cache = kc;
+	sl->sl_next = sl->sl_prev = NULL;
+	sl->sl_inuse = 0;
+
+	prevp = &sl->sl_free;
+	for (obj = page + SLAB_HDRSIZE; obj + kc->kc_size <= page + PAGE_SIZE;
+	     obj += kc->kc_size) {
+		*prevp = (void *)obj;
+		prevp = (void **)obj;
+	}
+	*prevp = NULL;
+
+	frame_set_owner(page, FRAME_OWNER_SLAB, sl);
+	return sl;
+}
+
+static
+void
+slab_destroy(struct slab *sl)
+{
+	frame_set_owner((vaddr_t)sl, FRAME_OWNER_NONE, NULL);
+	free_kpages((vaddr_t)sl);
+}
+
+/*
+ * Take up to N objects from the slabs into OBJS, making new slabs as
+ * needed. Returns how many were got; fewer than N only when out of
+ * memory.
+ */
+static
+unsigned
+slab_get(struct kmem_cache *kc, void **objs, unsigned n)
+{
+	struct slab *sl;
+	unsigned got = 0;
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_refills++;
+	while (got < n) {
+		sl = kc->kc_partial;
+		if (sl == NULL) {
+			spinlock_release(&kc->kc_lock);
+			sl = slab_create(kc);
+			spinlock_acquire(&kc->kc_lock);
+			if (sl == NULL) {
+				break;
+			}
+			slab_link(kc, sl);
+			kc->kc_nslabs++;
+			continue;
+		}
+		objs[got++] = sl->sl_free;
+		sl->sl_free = *(void **)sl->sl_free;
+		sl->sl_inuse++;
+		if (sl->sl_free == NULL) {
+			slab_unlink(kc, sl);
+		}
+	}
+	kc->kc_inuse += got;
+	spinlock_release(&kc->kc_lock);
+
+	return got;
+}
+
+/*
+ * Give N objects back to their slabs, and free the slabs that end up
+ * empty once the lock is dropped.
+ */
+static
+void
+slab_put(struct kmem_cache *kc, void **objs, unsigned n)
+{
+	struct slab *sl, *dead = NULL;
+	unsigned i;
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_flushes++;
+	for (i = 0; i < n; i++) {
+		sl = (struct slab *)((vaddr_t)objs[i] & PAGE_FRAME);
+		KASSERT(sl->sl_cache == kc);
+		KASSERT(sl->sl_inuse > 0);
+
+		if (sl->sl_free == NULL) {
+			slab_link(kc, sl);
+		}
+		*(void **)objs[i] = sl->sl_free;
+		sl->sl_free = objs[i];
+		sl->sl_inuse--;
+
+		/* keep one slab around so alloc/free cycles don't thrash */
+		if (sl->sl_inuse == 0 &&
+		    (kc->kc_partial != sl || sl->sl_next != NULL)) {
+			slab_unlink(kc, sl);
+			kc->kc_nslabs--;
+			sl->sl_next = dead;
+			dead = sl;
+		}
+	}
+	KASSERT(kc->kc_inuse >= n);
+	kc->kc_inuse -= n;
+	spinlock_release(&kc->kc_lock);
+
+	while (dead != NULL) {
+		sl = dead;
+		dead = sl->sl_next;
+		slab_destroy(sl);
+	}
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_magazine *mag;
+	void *obj = NULL;
+	int spl;
+
+	if (!kc->kc_listed) {
+		kmem_cache_setup(kc);
+	}
+
+	if (!CURCPU_EXISTS()) {
+		/* too early in boot for per-cpu state */
+		slab_get(kc, &obj, 1);
+		return obj;
+	}
+
+	spl = splhigh();
+	mag = &kc->kc_mags[curcpu->c_number];
+	if (mag->km_count == 0) {
+		mag->km_count = slab_get(kc, mag->km_objs, KMEM_MAG_SIZE / 2);
+	}
+	if (mag->km_count > 0) {
+		obj = mag->km_objs[--mag->km_count];
+	}
+	splx(spl);
+
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_magazine *mag;
+	int spl;
+
+	KASSERT(obj != NULL);
+	KASSERT(((struct slab *)((vaddr_t)obj & PAGE_FRAME))->sl_cache == kc);
+
+	if (!CURCPU_EXISTS()) {
+		slab_put(kc, &obj, 1);
+		return;
+	}
+
+	spl = splhigh();
+	mag = &kc->kc_mags[curcpu->c_number];
+	if (mag->km_count == KMEM_MAG_SIZE) {
+		slab_put(kc, &mag->km_objs[KMEM_MAG_SIZE / 2],
+			 KMEM_MAG_SIZE / 2);
+		mag->km_count = KMEM_MAG_SIZE / 2;
+	}
+	mag->km_objs[mag->km_count++] = obj;
+	splx(spl);
+}
+
+int
+kmem_kfree(void *ptr)
+{
+	struct slab *sl;
+	unsigned type;
+
+	sl = frame_get_owner((vaddr_t)ptr, &type);
+	if (type != FRAME_OWNER_SLAB) {
+		return -1;
+	}
+	kmem_cache_free(sl->sl_cache, ptr);
+	return 0;
+}
+
+#else /* !OPT_UNSW */
+
+/*
+ * Without the frame table there is nowhere to tag slab pages, so the
+ * caches are just names for kmalloc sizes.
+ */
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	void *obj;
+
+	if (!kc->kc_listed) {
+		kmem_cache_setup(kc);
+	}
+	obj = kmalloc(kc->kc_size);
+	if (obj != NULL) {
+		spinlock_acquire(&kc->kc_lock);
+		kc->kc_inuse++;
+		spinlock_release(&kc->kc_lock);
+	}
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(kc->kc_inuse > 0);
+	kc->kc_inuse--;
+	spinlock_release(&kc->kc_lock);
+	kfree(obj);
+}
+
+int
+kmem_kfree(void *ptr)
+{
+	(void)ptr;
+	return -1;
+}
+
+#endif /* OPT_UNSW */
+
+/*
+ * Print the caches. Objects sitting in magazines count as in use by
+ * the slabs but are free as far as callers go.
+ */
+void
+kmem_printstats(void)
+{
+	struct kmem_cache *kc;
+	unsigned i, cached;
+
+	kprintf("Slab caches:\n");
+	kprintf("  %-12s %6s %6s %6s %6s %8s %8s\n", "name", "size",
+		"slabs", "inuse", "cached", "refills", "flushes");
+
+	spinlock_acquire(&kmem_list_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		cached = 0;
+		for (i = 0; i < MAXCPUS; i++) {
+			cached += kc->kc_mags[i].km_count;
+		}
+		kprintf("  %-12s %6u %6u %6u %6u %8u %8u\n", kc->kc_name,
+			kc->kc_size, kc->kc_nslabs, kc->kc_inuse - cached,
+			cached, kc->kc_refills, kc->kc_flushes);
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kmem_list_lock);
+}
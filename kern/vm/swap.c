@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Swap space management.
+ *
+ * The swap device is divided into page-sized slots. Each slot has a
+ * reference count so that a page swapped out before a fork can be
+ * shared by parent and child until one of them faults it back in.
+ * Slots are handed out next-fit starting from the last allocation.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <stat.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <swap.h>
+
+static struct vnode *swap_vnode;	/* the swap device, NULL if none */
+static unsigned swap_nslots;		/* number of page slots */
+static uint16_t *swap_refs;		/* references to each slot */
+static unsigned swap_hint;		/* where to start looking next */
+static unsigned swap_inuse;		/* slots with nonzero refcount */
+
+/* statistics */
+static unsigned swap_pageouts;
+static unsigned swap_pageins;
+
+static struct spinlock swap_spinlock = SPINLOCK_INITIALIZER;
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat info;
+	struct vnode *vn;
+	unsigned i;
+	int result;
+
+	/* vfs_open destroys the string it's passed */
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, 0, &vn);
+	if (result) {
+		kprintf("swap: no %s (%s), swapping disabled\n",
+			SWAP_DEVICE, strerror(result));
+		return;
+	}
+
+	result = VOP_STAT(vn, &info);
+	if (result || info.st_size < PAGE_SIZE) {
+		kprintf("swap: cannot size %s, swapping disabled\n",
+			SWAP_DEVICE);
+		vfs_close(vn);
+		return;
+	}
+
+	swap_nslots = info.st_size / PAGE_SIZE;
+	swap_refs = kmalloc(swap_nslots * sizeof(swap_refs[0]));
+	if (swap_refs == NULL) {
+		kprintf("swap: out of memory, swapping disabled\n");
+		vfs_close(vn);
+		return;
+	}
+	for (i=0; i<swap_nslots; i++) {
+		swap_refs[i] = 0;
+	}
+
+	swap_vnode = vn;
+	kprintf("swap: %uk on %s\n", swap_nslots * PAGE_SIZE / 1024,
+		SWAP_DEVICE);
+}
+
+bool
+swap_enabled(void)
+{
+	return swap_vnode != NULL;
+}
+
+int
+swap_alloc(unsigned *slot)
+{
+	unsigned i, n;
+
+	if (swap_vnode == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_spinlock);
+	for (n=0; n<swap_nslots; n++) {
+		i = (swap_hint + n) % swap_nslots;
+		if (swap_refs[i] == 0) {
+			swap_refs[i] = 1;
+			swap_inuse++;
+			swap_hint = i + 1;
+			spinlock_release(&swap_spinlock);
+			*slot = i;
+			return 0;
+		}
+	}
+	spinlock_release(&swap_spinlock);
+	return ENOSPC;
+}
+
+void
+swap_incref(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_spinlock);
+	KASSERT(swap_refs[slot] > 0 && swap_refs[slot] < 0xffff);
+	swap_refs[slot]++;
+	spinlock_release(&swap_spinlock);
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_spinlock);
+	KASSERT(swap_refs[slot] > 0);
+	swap_refs[slot]--;
+	if (swap_refs[slot] == 0) {
+		swap_inuse--;
+	}
+	spinlock_release(&swap_spinlock);
+}
+
+/*
+ * Do the I/O for one page. The page is addressed through kseg0, so
+ * this is a kernel-space transfer straight into or out of the frame.
+ */
+static
+int
+swap_io(paddr_t paddr, unsigned slot, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_out(paddr_t paddr, unsigned slot)
+{
+	int result;
+
+	result = swap_io(paddr, slot, UIO_WRITE);
+	if (result == 0) {
+		spinlock_acquire(&swap_spinlock);
+		swap_pageouts++;
+		spinlock_release(&swap_spinlock);
+	}
+	return result;
+}
+
+int
+swap_in(paddr_t paddr, unsigned slot)
+{
+	int result;
+
+	result = swap_io(paddr, slot, UIO_READ);
+	if (result == 0) {
+		spinlock_acquire(&swap_spinlock);
+		swap_pageins++;
+		spinlock_release(&swap_spinlock);
+	}
+	return result;
+}
+
+void
+swap_printstats(void)
+{
+	if (swap_vnode == NULL) {
+		kprintf("Swap: disabled\n");
+		return;
+	}
+
+	spinlock_acquire(&swap_spinlock);
+	kprintf("Swap: %u/%u slots in use, %u pageouts, %u pageins\n",
+		swap_inuse, swap_nslots, swap_pageouts, swap_pageins);
+	spinlock_release(&swap_spinlock);
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Shared text page cache.
+ *
+ * A small chained hash table keyed on (vnode, virtual page), plus an
+ * index by frame number so the pager and page table teardown find an
+ * entry from its frame in constant time. Entries live as long as some
+ * address space maps the frame; once the cache holds the only
+ * reference, textcache_release frees it. Under memory
+ * pressure the pager may also take a page mapped by just one process
+ * (textcache_evict); being text, it is clean and is simply read in
+ * again on the next fault. The pager calls in with its own spinlock
+ * held, so the cache is protected by a spinlock too. Holding a
+ * vnode reference per entry stops the vnode from being reclaimed and
+ * its address reused for a different file while entries point at it.
+ * That reference can't be dropped under a spinlock, so released
+ * entries wait on a list until textcache_reap.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <vm.h>
+#include <textcache.h>
+
+#define TEXTCACHE_BUCKETS 64
+
+struct textpage {
+	struct vnode *tp_vnode;
+	vaddr_t tp_vaddr;
+	paddr_t tp_paddr;
+	struct textpage *tp_next;
+	struct textpage **tp_prevp;	/* what points at us in the chain */
+};
+
+static struct textpage *textcache[TEXTCACHE_BUCKETS];
+static struct textpage **textcache_frames;	/* entry for each frame */
+static uint32_t textcache_nframes;
+static struct textpage *textcache_dead;		/* released, not reaped */
+static struct spinlock textcache_lock = SPINLOCK_INITIALIZER;
+
+/* statistics */
+static unsigned textcache_pages;
+static unsigned textcache_hits;
+static unsigned textcache_misses;
+static unsigned textcache_evictions;
+
+static
+unsigned
+textcache_hash(struct vnode *v, vaddr_t vaddr)
+{
+	return (((uintptr_t)v >> 4) ^ (vaddr / PAGE_SIZE)) % TEXTCACHE_BUCKETS;
+}
+
+void
+textcache_bootstrap(void)
+{
+	uint32_t i;
+
+	textcache_nframes = ram_getsize() / PAGE_SIZE;
+	textcache_frames = kmalloc(textcache_nframes * sizeof(struct textpage *));
+	if (textcache_frames == NULL) {
+		panic("textcache: cannot allocate frame index\n");
+	}
+	for (i=0; i<textcache_nframes; i++) {
+		textcache_frames[i] = NULL;
+	}
+}
+
+/* Find the entry for the frame at PADDR. Caller holds the lock. */
+static
+struct textpage *
+textcache_byframe(paddr_t paddr)
+{
+	KASSERT(paddr / PAGE_SIZE < textcache_nframes);
+	return textcache_frames[paddr / PAGE_SIZE];
+}
+
+/* Take TP out of the table. Caller holds the lock. */
+static
+void
+textcache_unlink(struct textpage *tp)
+{
+	*tp->tp_prevp = tp->tp_next;
+	if (tp->tp_next != NULL) {
+		tp->tp_next->tp_prevp = tp->tp_prevp;
+	}
+	textcache_frames[tp->tp_paddr / PAGE_SIZE] = NULL;
+	textcache_pages--;
+}
+
+paddr_t
+textcache_lookup(struct vnode *v, vaddr_t vaddr)
+{
+	struct textpage *tp;
+	paddr_t paddr = 0;
+
+	spinlock_acquire(&textcache_lock);
+	for (tp = textcache[textcache_hash(v, vaddr)]; tp; tp = tp->tp_next) {
+		if (tp->tp_vnode == v && tp->tp_vaddr == vaddr) {
+			paddr = tp->tp_paddr;
+			frame_incref(paddr);
+			break;
+		}
+	}
+	if (paddr) {
+		textcache_hits++;
+	}
+	else {
+		textcache_misses++;
+	}
+	spinlock_release(&textcache_lock);
+	return paddr;
+}
+
+bool
+textcache_insert(struct vnode *v, vaddr_t vaddr, paddr_t paddr)
+{
+	struct textpage *tp, *other;
+	unsigned bucket = textcache_hash(v, vaddr);
+
+	/* if we can't remember the page it just stays private */
+	tp = kmalloc(sizeof(*tp));
+	if (tp == NULL) {
+		return false;
+	}
+	tp->tp_vnode = v;
+	tp->tp_vaddr = vaddr;
+	tp->tp_paddr = paddr;
+
+	VOP_INCREF(v);
+
+	spinlock_acquire(&textcache_lock);
+	/* another process may have loaded the same page meanwhile */
+	for (other = textcache[bucket]; other; other = other->tp_next) {
+		if (other->tp_vnode == v && other->tp_vaddr == vaddr) {
+			break;
+		}
+	}
+	if (other == NULL) {
+		frame_incref(paddr);
+		tp->tp_next = textcache[bucket];
+		if (tp->tp_next != NULL) {
+			tp->tp_next->tp_prevp = &tp->tp_next;
+		}
+		tp->tp_prevp = &textcache[bucket];
+		textcache[bucket] = tp;
+		KASSERT(textcache_byframe(paddr) == NULL);
+		textcache_frames[paddr / PAGE_SIZE] = tp;
+		textcache_pages++;
+	}
+	spinlock_release(&textcache_lock);
+
+	if (other != NULL) {
+		/* the caller's own reference keeps V alive */
+		VOP_DECREF(v);
+		kfree(tp);
+		return false;
+	}
+	return true;
+}
+
+struct vnode *
+textcache_evict(paddr_t paddr)
+{
+	struct textpage *tp;
+	struct vnode *v = NULL;
+
+	spinlock_acquire(&textcache_lock);
+	tp = textcache_byframe(paddr);
+	/* lookups take their frame reference under this lock too */
+	if (tp != NULL && frame_getref(paddr) == 2) {
+		textcache_unlink(tp);
+		/* the mapping's reference keeps the frame until it is unmapped */
+		free_kpages(PADDR_TO_KVADDR(paddr));
+		textcache_evictions++;
+		v = tp->tp_vnode;
+		kfree(tp);
+	}
+	spinlock_release(&textcache_lock);
+	return v;
+}
+
+void
+textcache_release(paddr_t paddr)
+{
+	struct textpage *tp;
+
+	spinlock_acquire(&textcache_lock);
+	tp = textcache_byframe(paddr);
+	if (tp != NULL && frame_getref(paddr) == 1) {
+		textcache_unlink(tp);
+		free_kpages(PADDR_TO_KVADDR(paddr));
+		tp->tp_next = textcache_dead;
+		textcache_dead = tp;
+	}
+	spinlock_release(&textcache_lock);
+}
+
+void
+textcache_reap(void)
+{
+	struct textpage *tp, *next;
+
+	spinlock_acquire(&textcache_lock);
+	tp = textcache_dead;
+	textcache_dead = NULL;
+	spinlock_release(&textcache_lock);
+
+	/* may reclaim the vnode, so not with the lock held */
+	for (; tp != NULL; tp = next) {
+		next = tp->tp_next;
+		VOP_DECREF(tp->tp_vnode);
+		kfree(tp);
+	}
+}
+
+void
+textcache_printstats(void)
+{
+	kprintf("Shared text: %u pages, %u hits, %u misses, %u evicted\n",
+		textcache_pages, textcache_hits, textcache_misses,
+		textcache_evictions);
+}
@@ -7,45 +7,686 @@
 #include <machine/tlb.h>
 #include <proc.h>
 #include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <synch.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <swap.h>
+#include <textcache.h>
+#include <uio.h>
+#include <vnode.h>
+
+/*
+ * Paging state.
+ *
+ * Each address space has its own as_lock, held by vm_fault while it
+ * looks up the region and makes room for the PTE; faults in different
+ * processes never wait for each other. It is dropped while the page
+ * is read in, since the file system may be waiting on a fault of its
+ * own (a read into user memory) with vfs_biglock held. The PTEs themselves, upages[]
+ * and the clock hand are under vm_spinlock, since page replacement
+ * edits other processes' page tables. It is only held for a few
+ * instructions at a time.
+ *
+ * Nothing is held across swap or file I/O. Instead the PTE of a page being
+ * paged in or out is marked FLAG_BUSY, and whoever set the bit owns
+ * the page until it clears it; everybody else waits on vm_busy_wchan.
+ * Only the pager, which never takes an as_lock, and the owning
+ * process itself make a PTE busy, so waiting for one with as_lock
+ * held cannot deadlock.
+ *
+ * upages[] maps every frame holding a private user page back to the
+ * address space and virtual page using it, so the clock hand can find
+ * the PTE to update. Frames shared copy-on-write are never evicted;
+ * vm_fault records the owner again once a frame is no longer shared.
+ * A text page mapped by one process counts as private too, although
+ * the text cache holds a second reference (FLAG_TEXT).
+ */
+struct upage {
+    struct addrspace *up_as;
+    vaddr_t up_vaddr;
+};
+
+static struct spinlock vm_spinlock = SPINLOCK_INITIALIZER;
+static struct wchan *vm_busy_wchan;
+static struct lock *vm_shootdown_lock;
+static struct semaphore *vm_shootdown_sem;
+static struct upage *upages;
+static uint32_t nupages;
+static uint32_t clock_hand;
+
+/* frames left for kernel allocations before user pages get evicted */
+#define VM_FREE_RESERVE 8
+
+static void 
+upage_track(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+    uint32_t frame = paddr / PAGE_SIZE;
+
+    KASSERT(frame < nupages);
+    upages[frame].up_as = as;
+    upages[frame].up_vaddr = vaddr;
+}
+
+/* forget the owner of a frame if it is the page table giving it up */
+static void 
+upage_untrack(paddr_t paddr, l1_page_table pagetable)
+{
+    uint32_t frame = paddr / PAGE_SIZE;
+
+    KASSERT(frame < nupages);
+    if(upages[frame].up_as != NULL &&
+        upages[frame].up_as->pagetable == pagetable
+    ){
+        upages[frame].up_as = NULL;
+    }
+}
+
+static page_table_entry *pagetable_lookup(l1_page_table pagetable, vaddr_t vaddr);
+
+/* Wait until nobody is paging PTE in or out. Called with vm_spinlock held. */
+static void
+pte_wait(page_table_entry *pte)
+{
+    while(IS_FLAG_SET(*pte, FLAG_BUSY)){
+        wchan_sleep(vm_busy_wchan, &vm_spinlock);
+    }
+}
+
+/* give up a busy PTE and wake anybody waiting for it */
+static void
+pte_unbusy(page_table_entry *pte)
+{
+    KASSERT(spinlock_do_i_hold(&vm_spinlock));
+    CLEAR_FLAG(*pte, FLAG_BUSY);
+    wchan_wakeall(vm_busy_wchan, &vm_spinlock);
+}
+
+/*
+ * Drop any TLB entry for VADDR in AS, here and on every other cpu.
+ * The other cpus acknowledge through vm_shootdown_sem. Shootdowns go
+ * one at a time under vm_shootdown_lock, so every V() we collect is
+ * for ours, no cpu has more than one queued, and none still looks at
+ * AS once we return.
+ */
+static void 
+vm_tlb_invalidate(struct addrspace *as, vaddr_t vaddr)
+{
+    struct tlbshootdown ts;
+    unsigned ncpus;
+
+    /* with ASIDs the entry may be here even if AS isn't running */
+    as_tlb_invalidate(as, vaddr);
+
+    ts.ts_as = as;
+    ts.ts_vaddr = PAGE_NUM(vaddr);
+    ts.ts_done = vm_shootdown_sem;
+    lock_acquire(vm_shootdown_lock);
+    ncpus = ipi_tlbshootdown_broadcast(&ts);
+    while(ncpus-- > 0){
+        P(vm_shootdown_sem);
+    }
+    lock_release(vm_shootdown_lock);
+}
+
+/*
+ * Page out one user page chosen by the clock (second chance)
+ * algorithm. FLAG_USED is the reference bit: vm_fault sets it when
+ * it loads a page into the TLB, and the clock hand clears it and
+ * drops the TLB entry so the next access faults and sets it again.
+ * A page whose bit is already clear when the hand comes round is
+ * written to swap and its frame freed. A text page is clean, so it is
+ * just taken out of the text cache and unmapped, to be read in from
+ * the executable again if needed.
+ *
+ * The PTE is kept busy over each shootdown and the swap write, with
+ * vm_spinlock dropped; that also stops the owner from destroying its
+ * address space under us.
+ */
+static int
+vm_evict(void)
+{
+    struct addrspace *as = NULL;
+    page_table_entry *pte = NULL;
+    page_table_entry old_entry;
+    struct vnode *text = NULL;
+    vaddr_t vaddr = 0;
+    paddr_t paddr = 0;
+    uint32_t scanned;
+    unsigned slot, ref;
+    int result;
+
+    spinlock_acquire(&vm_spinlock);
+
+    /* two sweeps: the first may do nothing but clear reference bits */
+    for(scanned = 0; scanned < 2 * nupages; ++scanned){
+        paddr = clock_hand * PAGE_SIZE;
+        as = upages[clock_hand].up_as;
+        vaddr = upages[clock_hand].up_vaddr;
+        clock_hand = (clock_hand + 1) % nupages;
+
+        if(as == NULL){
+            continue;
+        }
+        pte = pagetable_lookup(as->pagetable, vaddr);
+        KASSERT(pte != NULL);
+        if(IS_FLAG_SET(*pte, FLAG_BUSY)){
+            continue;
+        }
+        ref = frame_getref(paddr);
+        if(ref > 2 || (ref == 2 && !IS_FLAG_SET(*pte, FLAG_TEXT))){
+            continue;
+        }
+        KASSERT(IS_FLAG_SET(*pte, TLBLO_VALID));
+        KASSERT(PAGE_NUM(*pte) == paddr);
+        if(IS_FLAG_SET(*pte, FLAG_USED)){
+            CLEAR_FLAG(*pte, FLAG_USED);
+            SET_FLAG(*pte, FLAG_BUSY);
+            spinlock_release(&vm_spinlock);
+            vm_tlb_invalidate(as, vaddr);
+            spinlock_acquire(&vm_spinlock);
+            pte_unbusy(pte);
+            continue;
+        }
+        if(IS_FLAG_SET(*pte, FLAG_TEXT)){
+            text = textcache_evict(paddr);
+            if(text == NULL){
+                continue;
+            }
+        }
+        break;
+    }
+    if(scanned < 2 * nupages && text != NULL){
+        upages[paddr / PAGE_SIZE].up_as = NULL;
+        *pte = FLAG_BUSY;
+        spinlock_release(&vm_spinlock);
+
+        vm_tlb_invalidate(as, vaddr);
+        VOP_DECREF(text);
+
+        spinlock_acquire(&vm_spinlock);
+        pte_unbusy(pte);
+        spinlock_release(&vm_spinlock);
+        free_kpages(PADDR_TO_KVADDR(paddr));
+        return 0;
+    }
+    if(scanned == 2 * nupages || swap_alloc(&slot)){
+        spinlock_release(&vm_spinlock);
+        return ENOMEM;
+    }
+
+    /* unmap first, so the owner cannot touch the page while it is written */
+    old_entry = *pte;
+    *pte = SWAP_ENTRY(slot);
+    SET_FLAG(*pte, IS_FLAG_SET(old_entry, TLBLO_DIRTY | FLAG_DIRTY));
+    SET_FLAG(*pte, FLAG_BUSY);
+    upages[paddr / PAGE_SIZE].up_as = NULL;
+    spinlock_release(&vm_spinlock);
+
+    vm_tlb_invalidate(as, vaddr);
+    result = swap_out(paddr, slot);
+
+    spinlock_acquire(&vm_spinlock);
+    if(result){
+        *pte = old_entry | FLAG_BUSY;
+        upage_track(paddr, as, vaddr);
+        swap_free(slot);
+    }
+    pte_unbusy(pte);
+    spinlock_release(&vm_spinlock);
+
+    if(!result){
+        free_kpages(PADDR_TO_KVADDR(paddr));
+    }
+    return result;
+}
+
+/*
+ * Get a frame for a user page, paging something out if memory is
+ * low. A few frames are kept back so kmalloc can still succeed.
+ * ZEROED asks for a zero-filled page. Called without vm_spinlock.
+ */
+static vaddr_t 
+alloc_upage(bool zeroed)
+{
+    vaddr_t vaddr_base;
+
+    if(swap_enabled() && frame_table_nfree() < VM_FREE_RESERVE){
+        (void)vm_evict();
+    }
+    vaddr_base = zeroed ? alloc_zeroed_kpage() : alloc_kpages(1);
+    if(vaddr_base == 0 && swap_enabled() && vm_evict() == 0){
+        vaddr_base = zeroed ? alloc_zeroed_kpage() : alloc_kpages(1);
+    }
+    return vaddr_base;
+}
+
+/*
+ * Fill the freshly zeroed page at PADDR, mapped at page VADDR, with
+ * whatever parts of the executable belong there. Normally only the
+ * region being faulted on is file backed at VADDR, but a page may
+ * straddle the end of one segment and the start of the next.
+ */
+static int 
+region_load_page(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+    struct iovec iov;
+    struct uio ku;
+    vaddr_t start, end;
+    region_ptr curr;
+    int result;
+
+    for(unsigned i = 0; i < as->nregions; ++i){
+        curr = as->regions[i];
+        if(curr->vnode == NULL){
+            continue;
+        }
+        start = curr->file_vaddr > vaddr ? curr->file_vaddr : vaddr;
+        end = curr->file_vaddr + curr->file_size;
+        if(end > vaddr + PAGE_SIZE){
+            end = vaddr + PAGE_SIZE;
+        }
+        if(start >= end){
+            continue;
+        }
+
+        uio_kinit(&iov, &ku, (void *)(PADDR_TO_KVADDR(paddr) + (start - vaddr)),
+                  end - start, curr->file_offset + (start - curr->file_vaddr),
+                  UIO_READ);
+        result = VOP_READ(curr->vnode, &ku);
+        if(result){
+            return result;
+        }
+        if(ku.uio_resid != 0){
+            /* the file was truncated under us */
+            return EIO;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Pages of a read-only, executable, file-backed region are the same
+ * in every process running that file, so they come from the shared
+ * text cache. A region is only writable while exec is loading it.
+ */
+static bool 
+region_is_text(region_ptr curr)
+{
+    return curr->vnode != NULL &&
+        IS_FLAG_SET(CURR_PERMISSION(curr->permission), FLAG_EXECUTE) &&
+        !IS_FLAG_SET(CURR_PERMISSION(curr->permission), FLAG_WRITE);
+}
 
 /* Place your page table functions here */
+
+/*
+ * Copy-on-write: fork gives the child a share of every resident
+ * frame. Both mappings lose TLBLO_DIRTY so the first write from
+ * either side traps with VM_FAULT_READONLY and pagetable_cow() makes
+ * the private copy; the caller must flush the parent's TLB.
+ * Swapped-out pages share their swap slot instead. This and
+ * pte_release are called with vm_spinlock held.
+ */
+static void 
+pte_share(page_table_entry *src, page_table_entry *dest)
+{
+    if(IS_FLAG_SET(*src, FLAG_SWAPPED)){
+        swap_incref(SWAP_SLOT(*src));
+    }
+    else{
+        CLEAR_FLAG(*src, TLBLO_DIRTY);
+        frame_incref(PAGE_NUM(*src));
+    }
+    *dest = *src;
+}
+
+/* give up the frame or swap slot behind ENTRY */
+static void 
+pte_release(l1_page_table pagetable, page_table_entry entry)
+{
+    if(IS_FLAG_SET(entry, FLAG_SWAPPED)){
+        swap_free(SWAP_SLOT(entry));
+    }
+    else if(IS_FLAG_SET(entry, TLBLO_VALID)){
+        upage_untrack(PAGE_NUM(entry), pagetable);
+        free_kpages(PADDR_TO_KVADDR(PAGE_NUM(entry)));
+        if(IS_FLAG_SET(entry, FLAG_TEXT)){
+            /* the text cache may hold the last reference now */
+            textcache_release(PAGE_NUM(entry));
+        }
+    }
+}
+
+#if OPT_HPT
+
+/*
+ * Hashed page table.
+ *
+ * One table, sized from physical memory at boot, holds the PTEs of
+ * every address space, keyed by (page table, virtual page). Entries
+ * in the same bucket are chained through he_next. Each page table
+ * also chains the entries it owns through he_link/he_prev, so fork
+ * and exit walk only their own pages; free entries are chained
+ * through he_link. There are HPT_RATIO entries per frame because
+ * pages shared by fork and pages out on swap need an entry each
+ * without holding a frame. All of it is protected by vm_spinlock.
+ */
+struct hpt_entry {
+    l1_page_table he_owner;     /* NULL if free */
+    vaddr_t he_vaddr;
+    page_table_entry he_pte;
+    uint32_t he_next;
+    uint32_t he_link;
+    uint32_t he_prev;
+};
+
+#define HPT_NONE  0xffffffff
+#define HPT_RATIO 2
+
+static struct hpt_entry *hpt;
+static uint32_t *hpt_buckets;
+static uint32_t hpt_nentries;
+static uint32_t hpt_shift;      /* 32 - log2(number of buckets) */
+static uint32_t hpt_free;
+
+static void 
+hpt_bootstrap(void)
+{
+    uint32_t nbuckets = 2;
+
+    hpt_shift = 31;
+    while(nbuckets < nupages){
+        nbuckets <<= 1;
+        hpt_shift--;
+    }
+    hpt_nentries = nupages * HPT_RATIO;
+    hpt = kmalloc(hpt_nentries * sizeof(struct hpt_entry));
+    hpt_buckets = kmalloc(nbuckets * sizeof(uint32_t));
+    if(hpt == NULL || hpt_buckets == NULL){
+        panic("vm: cannot allocate hashed page table\n");
+    }
+    for(uint32_t i = 0; i < nbuckets; ++i){
+        hpt_buckets[i] = HPT_NONE;
+    }
+    for(uint32_t i = 0; i < hpt_nentries; ++i){
+        hpt[i].he_owner = NULL;
+        hpt[i].he_link = i + 1 < hpt_nentries ? i + 1 : HPT_NONE;
+    }
+    hpt_free = 0;
+}
+
+/* Fibonacci hashing: the top bits of the product are the best mixed */
+static uint32_t 
+hpt_hash(l1_page_table pagetable, vaddr_t vaddr)
+{
+    uint32_t key = ((uint32_t)(uintptr_t)pagetable >> 4) ^ (vaddr >> 12);
+
+    return (key * 2654435761U) >> hpt_shift;
+}
+
+static uint32_t 
+hpt_find(l1_page_table pagetable, vaddr_t vaddr)
+{
+    uint32_t i;
+
+    for(i = hpt_buckets[hpt_hash(pagetable, vaddr)]; i != HPT_NONE; i = hpt[i].he_next){
+        if(hpt[i].he_owner == pagetable && hpt[i].he_vaddr == vaddr){
+            break;
+        }
+    }
+    return i;
+}
+
+static void 
+hpt_remove(l1_page_table pagetable, uint32_t i)
+{
+    uint32_t *link = &hpt_buckets[hpt_hash(pagetable, hpt[i].he_vaddr)];
+
+    while(*link != i){
+        KASSERT(*link != HPT_NONE);
+        link = &hpt[*link].he_next;
+    }
+    *link = hpt[i].he_next;
+
+    if(hpt[i].he_prev != HPT_NONE){
+        hpt[hpt[i].he_prev].he_link = hpt[i].he_link;
+    }
+    else{
+        pagetable->pt_first = hpt[i].he_link;
+    }
+    if(hpt[i].he_link != HPT_NONE){
+        hpt[hpt[i].he_link].he_prev = hpt[i].he_prev;
+    }
+    pagetable->pt_nentries--;
+
+    hpt[i].he_owner = NULL;
+    hpt[i].he_link = hpt_free;
+    hpt_free = i;
+}
+
+l1_page_table 
+pagetable_create_l1(void)
+{
+    l1_page_table pagetable = kmalloc(sizeof(struct pagetable));
+    if(pagetable == NULL){
+        return NULL;
+    }
+    pagetable->pt_first = HPT_NONE;
+    pagetable->pt_nentries = 0;
+    return pagetable;
+}
+
+static page_table_entry *
+pagetable_lookup(l1_page_table pagetable, vaddr_t vaddr)
+{
+    uint32_t i = hpt_find(pagetable, PAGE_NUM(vaddr));
+
+    if(i == HPT_NONE){
+        return NULL;
+    }
+    return &hpt[i].he_pte;
+}
+
+/* pagetable_reserve with vm_spinlock already held */
+static page_table_entry *
+hpt_insert(l1_page_table pagetable, vaddr_t vaddr)
+{
+    page_table_entry *pte = pagetable_lookup(pagetable, vaddr);
+    uint32_t i, bucket;
+
+    KASSERT(spinlock_do_i_hold(&vm_spinlock));
+    if(pte != NULL){
+        return pte;
+    }
+    if(hpt_free == HPT_NONE){
+        return NULL;
+    }
+    i = hpt_free;
+    hpt_free = hpt[i].he_link;
+
+    hpt[i].he_owner = pagetable;
+    hpt[i].he_vaddr = PAGE_NUM(vaddr);
+    hpt[i].he_pte = 0;
+    bucket = hpt_hash(pagetable, hpt[i].he_vaddr);
+    hpt[i].he_next = hpt_buckets[bucket];
+    hpt_buckets[bucket] = i;
+
+    hpt[i].he_prev = HPT_NONE;
+    hpt[i].he_link = pagetable->pt_first;
+    if(pagetable->pt_first != HPT_NONE){
+        hpt[pagetable->pt_first].he_prev = i;
+    }
+    pagetable->pt_first = i;
+    pagetable->pt_nentries++;
+    return &hpt[i].he_pte;
+}
+
+static page_table_entry *
+pagetable_reserve(l1_page_table pagetable, vaddr_t vaddr)
+{
+    page_table_entry *pte;
+
+    spinlock_acquire(&vm_spinlock);
+    pte = hpt_insert(pagetable, vaddr);
+    spinlock_release(&vm_spinlock);
+    return pte;
+}
+
+/* the entry is given back to the table rather than kept zeroed */
+static void 
+pagetable_clear(l1_page_table pagetable, vaddr_t vaddr)
+{
+    uint32_t i = hpt_find(pagetable, PAGE_NUM(vaddr));
+
+    if(i != HPT_NONE){
+        hpt_remove(pagetable, i);
+    }
+}
+
+uint32_t 
+pagetable_copy(l1_page_table src_ptable, l1_page_table dest_ptable)
+{
+    page_table_entry *dest;
+
+    spinlock_acquire(&vm_spinlock);
+    for(uint32_t i = src_ptable->pt_first; i != HPT_NONE; i = hpt[i].he_link){
+        pte_wait(&hpt[i].he_pte);
+        if(hpt[i].he_pte == 0){
+            continue;
+        }
+        dest = hpt_insert(dest_ptable, hpt[i].he_vaddr);
+        if(dest == NULL){
+            spinlock_release(&vm_spinlock);
+            return ENOMEM;
+        }
+        pte_share(&hpt[i].he_pte, dest);
+    }
+    spinlock_release(&vm_spinlock);
+    return 0;
+}
+
+void 
+pagetable_destroy(l1_page_table pagetable)
+{
+    uint32_t i;
+
+    if (pagetable) {
+        spinlock_acquire(&vm_spinlock);
+        while (pagetable->pt_first != HPT_NONE) {
+            i = pagetable->pt_first;
+            pte_wait(&hpt[i].he_pte);
+            pte_release(pagetable, hpt[i].he_pte);
+            hpt_remove(pagetable, i);
+        }
+        spinlock_release(&vm_spinlock);
+        kfree(pagetable);
+    }
+}
+
+size_t 
+pagetable_size(l1_page_table pagetable)
+{
+    return sizeof(struct pagetable) +
+        pagetable->pt_nentries * sizeof(struct hpt_entry);
+}
+
+size_t 
+pagetable_global_size(void)
+{
+    return hpt_nentries * sizeof(struct hpt_entry) +
+        ((size_t)1 << (32 - hpt_shift)) * sizeof(uint32_t);
+}
+
+#else /* !OPT_HPT */
+
 l1_page_table 
 pagetable_create_l1(void)
 {
-    //2048*4B = 8K>PAGE_SIZE
-    l1_page_table pagetable = kmalloc(L1_PAGETABLE_NUM * sizeof(l2_page_tabel));
+    //32*4B = 128B, the middle tables come later
+    l1_page_table pagetable = kmalloc(sizeof(struct pagetable));
+    if(pagetable == NULL){
+        return NULL;
+    }
+    for(uint16_t i = 0; i < PT_DIR_NUM; ++i){
+        pagetable->pt_dir[i] = NULL;
+    }
     return pagetable;
 }
 
+l2_page_tabel 
+pagetable_get_l2(l1_page_table pagetable, uint16_t l1_ptable_num)
+{
+    l2_page_tabel *mid = pagetable->pt_dir[l1_ptable_num / PT_MID_NUM];
+
+    KASSERT(l1_ptable_num < L1_PAGETABLE_NUM);
+    if(mid == NULL){
+        return NULL;
+    }
+    return mid[l1_ptable_num % PT_MID_NUM];
+}
+
 uint32_t 
 pagetable_create_l2(l1_page_table pagetable, uint16_t l1_ptable_num)
 {
+    l2_page_tabel **midp = &pagetable->pt_dir[l1_ptable_num / PT_MID_NUM];
+
+    KASSERT(l1_ptable_num < L1_PAGETABLE_NUM);
+    if(*midp == NULL){
+        //32*4B = 128B
+        l2_page_tabel *mid = kmalloc(PT_MID_NUM * sizeof(l2_page_tabel));
+        if(mid == NULL){
+            return ENOMEM;
+        }
+        for(uint16_t i = 0; i < PT_MID_NUM; ++i){
+            mid[i] = NULL;
+        }
+        *midp = mid;
+    }
+
     //512*4B = 2K<PAGE_SIZE
     l2_page_tabel sub_pagetable = kmalloc(L2_PAGETABLE_NUM * sizeof(paddr_t));
     if(sub_pagetable == NULL){
         return ENOMEM;
     }
-    pagetable[l1_ptable_num] = sub_pagetable;
     for(uint16_t i = 0; i < L2_PAGETABLE_NUM; ++i){
-        pagetable[l1_ptable_num][i] = 0;
+        sub_pagetable[i] = 0;
     }
+    (*midp)[l1_ptable_num % PT_MID_NUM] = sub_pagetable;
     return 0;
 }
 
-uint32_t 
-pagetable_insert(l1_page_table pagetable, uint16_t l1_ptable_num, uint16_t l2_page_num, uint32_t dirty_bit)
+static page_table_entry *
+pagetable_lookup(l1_page_table pagetable, vaddr_t vaddr)
 {
-    vaddr_t vaddr_base = alloc_kpages(1);
-    if(vaddr_base == 0){
-        return ENOMEM;
+    l2_page_tabel l2_table = pagetable_get_l2(pagetable, L1_PAGE_NUM(vaddr));
+
+    if(!l2_table){
+        return NULL;
+    }
+    return &l2_table[L2_PAGE_NUM(vaddr)];
+}
+
+static page_table_entry *
+pagetable_reserve(l1_page_table pagetable, vaddr_t vaddr)
+{
+    if(pagetable_get_l2(pagetable, L1_PAGE_NUM(vaddr)) == NULL &&
+        pagetable_create_l2(pagetable, L1_PAGE_NUM(vaddr))
+    ){
+        return NULL;
+    }
+    return pagetable_lookup(pagetable, vaddr);
+}
+
+static void 
+pagetable_clear(l1_page_table pagetable, vaddr_t vaddr)
+{
+    page_table_entry *pte = pagetable_lookup(pagetable, vaddr);
+
+    if(pte != NULL){
+        *pte = 0;
     }
-    ZERO_FILLED_PAGE((void *)vaddr_base);
-    paddr_t paddr_base = KVADDR_TO_PADDR(vaddr_base);
-    pagetable[l1_ptable_num][l2_page_num] = PAGE_NUM(paddr_base);
-    SET_FLAG(pagetable[l1_ptable_num][l2_page_num], TLBLO_VALID);
-    SET_FLAG(pagetable[l1_ptable_num][l2_page_num], dirty_bit); 
-    SET_FLAG(pagetable[l1_ptable_num][l2_page_num], FLAG_USED); //!TODO Other flag
-    return 0;
 }
 
 uint32_t 
@@ -53,24 +694,20 @@ pagetable_copy(l1_page_table src_ptable, l1_page_table dest_ptable)
 {
     for(uint16_t i = 0; i < L1_PAGETABLE_NUM; ++i)
     {
-        if(src_ptable[i] != NULL){
-            if(pagetable_create_l2(dest_ptable, i)) return ENOMEM; 
+        l2_page_tabel src_l2 = pagetable_get_l2(src_ptable, i);
+        if(src_l2 != NULL){
+            if(pagetable_create_l2(dest_ptable, i)){
+                return ENOMEM; 
+            }
+            l2_page_tabel dest_l2 = pagetable_get_l2(dest_ptable, i);
+            spinlock_acquire(&vm_spinlock);
             for(uint16_t j = 0; j < L2_PAGETABLE_NUM; ++j){
-                if(src_ptable[i][j] != 0){
-                    vaddr_t vaddr_base = alloc_kpages(1);
-                    if(vaddr_base == 0) return ENOMEM;
-                    ZERO_FILLED_PAGE((void *)vaddr_base);
-                    if(!memmove((void *)vaddr_base, (const void *)PADDR_TO_KVADDR(PAGE_NUM(src_ptable[i][j])),PAGE_SIZE)){
-                        pagetable_destroy(dest_ptable);
-                        return ENOMEM;
-                    }
-                    uint32_t dirty_bit = IS_FLAG_SET(src_ptable[i][j], TLBLO_DIRTY);
-                    dest_ptable[i][j] = PAGE_NUM(KVADDR_TO_PADDR(vaddr_base));
-                    SET_FLAG(dest_ptable[i][j], TLBLO_VALID); 
-                    SET_FLAG(dest_ptable[i][j], dirty_bit);
-                    SET_FLAG(dest_ptable[i][j], FLAG_USED); //!TODO Other flag
+                pte_wait(&src_l2[j]);
+                if(src_l2[j] != 0){
+                    pte_share(&src_l2[j], &dest_l2[j]);
                 }
             }
+            spinlock_release(&vm_spinlock);
         }
     }
     return 0;
@@ -80,20 +717,210 @@ void
 pagetable_destroy(l1_page_table pagetable)
 {
     if (pagetable) {
+        spinlock_acquire(&vm_spinlock);
         for (uint16_t i = 0; i < L1_PAGETABLE_NUM; ++i) {
-            if (pagetable[i] != NULL) {
+            l2_page_tabel l2_table = pagetable_get_l2(pagetable, i);
+            if (l2_table != NULL) {
                 for(uint16_t j = 0; j < L2_PAGETABLE_NUM; ++j){
-                    if(IS_FLAG_SET(pagetable[i][j],FLAG_USED)){
-                        free_kpages(PADDR_TO_KVADDR(PAGE_NUM(pagetable[i][j])));
-                    }
+                    pte_wait(&l2_table[j]);
+                    pte_release(pagetable, l2_table[j]);
+                    l2_table[j] = 0;
                 }
-                kfree(pagetable[i]);
             }
         }
+        spinlock_release(&vm_spinlock);
+        /* nothing can reach the tables now that no frame is tracked to them */
+        for (uint16_t i = 0; i < L1_PAGETABLE_NUM; ++i) {
+            kfree(pagetable_get_l2(pagetable, i));
+        }
+        for (uint16_t i = 0; i < PT_DIR_NUM; ++i) {
+            kfree(pagetable->pt_dir[i]);
+        }
         kfree(pagetable);
     }
 }
 
+size_t 
+pagetable_size(l1_page_table pagetable)
+{
+    size_t size = sizeof(struct pagetable);
+
+    for(uint16_t i = 0; i < PT_DIR_NUM; ++i){
+        if(pagetable->pt_dir[i] == NULL){
+            continue;
+        }
+        size += PT_MID_NUM * sizeof(l2_page_tabel);
+        for(uint16_t j = 0; j < PT_MID_NUM; ++j){
+            if(pagetable->pt_dir[i][j] != NULL){
+                size += L2_PAGETABLE_NUM * sizeof(page_table_entry);
+            }
+        }
+    }
+    return size;
+}
+
+size_t 
+pagetable_global_size(void)
+{
+    return 0;
+}
+
+#endif /* OPT_HPT */
+
+uint32_t 
+pagetable_insert(page_table_entry *pte, uint32_t dirty_bit)
+{
+    vaddr_t vaddr_base = alloc_upage(true);
+    if(vaddr_base == 0){
+        return ENOMEM;
+    }
+    paddr_t paddr_base = KVADDR_TO_PADDR(vaddr_base);
+    *pte = PAGE_NUM(paddr_base);
+    SET_FLAG(*pte, TLBLO_VALID);
+    SET_FLAG(*pte, dirty_bit); 
+    SET_FLAG(*pte, FLAG_USED); //!TODO Other flag
+    return 0;
+}
+
+uint32_t 
+pagetable_swapin(page_table_entry *pte)
+{
+    page_table_entry entry = *pte;
+    unsigned slot = SWAP_SLOT(entry);
+
+    KASSERT(IS_FLAG_SET(entry, FLAG_SWAPPED));
+
+    vaddr_t vaddr_base = alloc_upage(false);
+    if(vaddr_base == 0){
+        return ENOMEM;
+    }
+    paddr_t paddr_base = KVADDR_TO_PADDR(vaddr_base);
+    if(swap_in(paddr_base, slot)){
+        free_kpages(vaddr_base);
+        return EIO;
+    }
+    /* the frame is private now even if the slot was shared by fork */
+    swap_free(slot);
+
+    *pte = PAGE_NUM(paddr_base);
+    SET_FLAG(*pte, TLBLO_VALID);
+    SET_FLAG(*pte, IS_FLAG_SET(entry, TLBLO_DIRTY | FLAG_DIRTY));
+    SET_FLAG(*pte, FLAG_USED);
+    return 0;
+}
+
+/*
+ * Give *PTE a private copy of its shared frame. The reference to the
+ * shared frame stays with the caller, to drop once the new entry is
+ * installed.
+ */
+uint32_t 
+pagetable_cow(page_table_entry *pte)
+{
+    paddr_t old_paddr = PAGE_NUM(*pte);
+
+    vaddr_t vaddr_base = alloc_upage(false);
+    if(vaddr_base == 0){
+        return ENOMEM;
+    }
+    memmove((void *)vaddr_base, (const void *)PADDR_TO_KVADDR(old_paddr), PAGE_SIZE);
+    *pte = PAGE_NUM(KVADDR_TO_PADDR(vaddr_base));
+    SET_FLAG(*pte, TLBLO_VALID);
+    SET_FLAG(*pte, TLBLO_DIRTY);
+    SET_FLAG(*pte, FLAG_USED);
+    return 0;
+}
+
+void 
+pagetable_unmap(l1_page_table pagetable, vaddr_t start, vaddr_t end)
+{
+    page_table_entry *pte;
+
+    spinlock_acquire(&vm_spinlock);
+    for (vaddr_t vaddr = PAGE_NUM(start); vaddr < end; vaddr += PAGE_SIZE) {
+        pte = pagetable_lookup(pagetable, vaddr);
+        if (pte == NULL) {
+            continue;
+        }
+        pte_wait(pte);
+        pte_release(pagetable, *pte);
+        pagetable_clear(pagetable, vaddr);
+    }
+    spinlock_release(&vm_spinlock);
+}
+
+/*
+ * Each dirty page is picked up under vm_spinlock and written with no
+ * lock held, since the file system may itself be waiting on a fault.
+ * A resident page is pinned by an extra frame reference for the write,
+ * which keeps the pager away from it; one out on swap is read back in
+ * with its PTE busy.
+ */
+int 
+pagetable_writeback(l1_page_table pagetable, vaddr_t start, size_t len,
+                    struct vnode *v, off_t offset)
+{
+    struct iovec iov;
+    struct uio ku;
+    page_table_entry *pte;
+    page_table_entry entry;
+    paddr_t paddr;
+    size_t done, chunk;
+    bool swapped;
+    int result = 0;
+
+    for (done = 0; done < len && result == 0; done += PAGE_SIZE) {
+        spinlock_acquire(&vm_spinlock);
+        pte = pagetable_lookup(pagetable, start + done);
+        if (pte != NULL) {
+            pte_wait(pte);
+        }
+        if (pte == NULL || !IS_FLAG_SET(*pte, FLAG_DIRTY)) {
+            spinlock_release(&vm_spinlock);
+            continue;
+        }
+        entry = *pte;
+        swapped = IS_FLAG_SET(entry, FLAG_SWAPPED);
+        if (swapped) {
+            SET_FLAG(*pte, FLAG_BUSY);
+        }
+        else {
+            frame_incref(PAGE_NUM(entry));
+        }
+        spinlock_release(&vm_spinlock);
+
+        if (swapped && pagetable_swapin(&entry)) {
+            result = ENOMEM;
+        }
+        paddr = PAGE_NUM(entry);
+        if (result == 0) {
+            chunk = len - done < PAGE_SIZE ? len - done : PAGE_SIZE;
+            uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr),
+                      chunk, offset + done, UIO_WRITE);
+            result = VOP_WRITE(v, &ku);
+        }
+
+        spinlock_acquire(&vm_spinlock);
+        if (swapped) {
+            *pte = entry | FLAG_BUSY;
+        }
+        /* clean again; the next write faults and marks it */
+        if (result == 0 && PAGE_NUM(*pte) == paddr) {
+            CLEAR_FLAG(*pte, FLAG_DIRTY);
+            CLEAR_FLAG(*pte, TLBLO_DIRTY);
+        }
+        if (swapped) {
+            pte_unbusy(pte);
+        }
+        spinlock_release(&vm_spinlock);
+
+        if (!swapped) {
+            free_kpages(PADDR_TO_KVADDR(paddr));
+        }
+    }
+    return result;
+}
+
 void vm_bootstrap(void)
 {
     /* Initialise any global components of your VM sub-system here.  
@@ -101,87 +928,368 @@ void vm_bootstrap(void)
      * You may or may not need to add anything here depending what's
      * provided or required by the assignment spec.
      */
+    nupages = ram_getsize() / PAGE_SIZE;
+    upages = kmalloc(nupages * sizeof(struct upage));
+    if(upages == NULL){
+        panic("vm: cannot allocate user page map\n");
+    }
+    for(uint32_t i = 0; i < nupages; ++i){
+        upages[i].up_as = NULL;
+    }
+    clock_hand = 0;
+
+    vm_busy_wchan = wchan_create("vm busy");
+    vm_shootdown_lock = lock_create("vm shootdown");
+    vm_shootdown_sem = sem_create("vm shootdown", 0);
+    if(vm_busy_wchan == NULL || vm_shootdown_lock == NULL ||
+        vm_shootdown_sem == NULL
+    ){
+        panic("vm: cannot create locks\n");
+    }
+
+#if OPT_HPT
+    hpt_bootstrap();
+#endif
+    swap_bootstrap();
+    textcache_bootstrap();
+    frame_zero_bootstrap();
 }
 
-int
-vm_fault(int faulttype, vaddr_t faultaddress)
+/*
+ * TLB fault-around.
+ *
+ * Programs that walk through memory take a TLB miss on every page.
+ * When a miss lands in a part of the page table that is already
+ * populated, the next vm_faultaround_pages resident pages are loaded
+ * into the TLB along with the one that faulted. A prefetched PTE is
+ * marked FLAG_PREFETCHED until it is next faulted on; a miss on a
+ * page that still carries the mark means the prefetched entry left
+ * the TLB without saving a fault, and is counted as wasted.
+ */
+static unsigned vm_faultaround_pages = VM_FAULTAROUND_DEFAULT;
+
+void 
+vm_set_faultaround(unsigned npages)
 {
-    struct addrspace *as;
-    region_ptr curRegion;
-    paddr_t ppage_base = 0;
-    uint32_t l1_index, l2_index;
-    uint32_t entry_hi, entry_lo;
-    uint32_t dirty_bit = 0;
-    int spl;
+    if(npages > VM_FAULTAROUND_MAX){
+        npages = VM_FAULTAROUND_MAX;
+    }
+    vm_faultaround_pages = npages;
+}
 
-    as = proc_getas();
+unsigned 
+vm_get_faultaround(void)
+{
+    return vm_faultaround_pages;
+}
 
-    if((faulttype == VM_FAULT_READONLY)| !faultaddress | !as){
-        return EFAULT;
-    }    
-    
-    faultaddress = PAGE_NUM(faultaddress);
-    curRegion = as->region_start;
-    
-    while(curRegion){
-        if(faultaddress >= curRegion->base && 
-            faultaddress < curRegion->base + curRegion->size
-        ){
+/* Called with vm_spinlock held, which keeps interrupts off. */
+static void 
+vm_faultaround(l1_page_table pagetable, vaddr_t faultaddress, uint32_t asid)
+{
+    page_table_entry *pte;
+    vaddr_t vaddr;
+    uint32_t entry_hi;
+    unsigned i;
+
+    for(i = 1; i <= vm_faultaround_pages; ++i){
+        vaddr = faultaddress + i * PAGE_SIZE;
+        if(vaddr >= USERSPACETOP){
             break;
         }
-        curRegion = curRegion->next;
+        pte = pagetable_lookup(pagetable, vaddr);
+        if(pte == NULL || !IS_FLAG_SET(*pte, TLBLO_VALID) ||
+            IS_FLAG_SET(*pte, FLAG_BUSY)
+        ){
+            continue;
+        }
+        entry_hi = vaddr | (asid << TLBHI_PIDSHIFT);
+        /* never load the same page twice */
+        if(tlb_probe(entry_hi, 0) >= 0){
+            continue;
+        }
+        tlb_random(entry_hi, *pte & ~FLAG_PREFETCHED);
+        SET_FLAG(*pte, FLAG_PREFETCHED);
+        curcpu->c_tlb.ct_prefetched++;
     }
-    if(!curRegion) {
+}
+
+/*
+ * Software TLB fast path.
+ *
+ * Most TLB misses are on pages that are resident and already have
+ * their reference bit set. If the software TLB of AS knows the PTE
+ * and the frame is ours alone, the entry is loaded straight into the
+ * TLB with no region lookup, page table walk or lock. Nothing here
+ * writes the PTE, so it cannot race with the pager: a page the pager
+ * unmaps meanwhile has its shootdown delivered once we lower spl,
+ * which removes the entry we just loaded. Anything else, including a
+ * fault-around prefetch being used, goes the slow way.
+ */
+static bool vm_stlb_enabled = true;
+
+void 
+vm_set_stlb(bool on)
+{
+    vm_stlb_enabled = on;
+}
+
+bool 
+vm_get_stlb(void)
+{
+    return vm_stlb_enabled;
+}
+
+static bool 
+vm_fault_fast(struct addrspace *as, vaddr_t faultaddress)
+{
+    struct stlb_entry *se = &as->stlb[VM_STLB_SLOT(faultaddress)];
+    page_table_entry entry;
+    uint32_t entry_hi;
+    int spl;
+
+    spl = splhigh();
+    if(se->se_pte == NULL || se->se_vaddr != faultaddress){
+        curcpu->c_tlb.ct_stlb_misses++;
+        splx(spl);
+        return false;
+    }
+    entry = *se->se_pte;
+    if(!IS_FLAG_SET(entry, TLBLO_VALID) || !IS_FLAG_SET(entry, FLAG_USED) ||
+        IS_FLAG_SET(entry, FLAG_PREFETCHED | FLAG_BUSY) ||
+        upages[PAGE_NUM(entry) / PAGE_SIZE].up_as != as
+    ){
+        curcpu->c_tlb.ct_stlb_misses++;
+        splx(spl);
+        return false;
+    }
+    entry_hi = faultaddress | (as_asid(as) << TLBHI_PIDSHIFT);
+    tlb_random(entry_hi, entry);
+    curcpu->c_tlb.ct_misses++;
+    curcpu->c_tlb.ct_stlb_hits++;
+    splx(spl);
+    return true;
+}
+
+/*
+ * Find a frame for a fault on ENTRY, the PTE of page VADDR in
+ * CURREGION of AS: swap the page in, copy it for copy-on-write, or
+ * fill a new frame from the text cache, the executable or zeros. The
+ * PTE is busy and no lock is held, since this sleeps on I/O. Hands
+ * back the entry to install in *RET.
+ */
+static int
+vm_page_fill(struct addrspace *as, region_ptr curRegion,
+             page_table_entry entry, vaddr_t vaddr, page_table_entry *ret)
+{
+    uint32_t dirty_bit = 0;
+    paddr_t shared;
+
+    *ret = entry;
+    if(IS_FLAG_SET(entry, FLAG_SWAPPED)){
+        return pagetable_swapin(ret) ? ENOMEM : 0;
+    }
+    if(IS_FLAG_SET(entry, TLBLO_VALID)){
+        return pagetable_cow(ret) ? ENOMEM : 0;
+    }
+
+    if(region_is_text(curRegion)){
+        shared = textcache_lookup(curRegion->vnode, vaddr);
+        if(shared){
+            *ret = PAGE_NUM(shared);
+            SET_FLAG(*ret, TLBLO_VALID | FLAG_TEXT);
+            return 0;
+        }
+    }
+    /* mapped file pages start read-only so we see the first write */
+    if(IS_FLAG_SET(curRegion->permission, FLAG_WRITE) && !curRegion->mapped){
+        dirty_bit = TLBLO_DIRTY;
+    }
+    if(pagetable_insert(ret, dirty_bit)){
+        return ENOMEM;
+    }
+    if(region_load_page(as, vaddr, PAGE_NUM(*ret))){
+        free_kpages(PADDR_TO_KVADDR(PAGE_NUM(*ret)));
         return EFAULT;
     }
-    ppage_base = KVADDR_TO_PADDR(faultaddress);
-    l1_index = L1_PAGE_NUM(ppage_base);
-    l2_index = L2_PAGE_NUM(ppage_base);
-    
-    if(!as->pagetable[l1_index]){
-        if(pagetable_create_l2(as->pagetable, l1_index)){
+    if(region_is_text(curRegion) &&
+        textcache_insert(curRegion->vnode, vaddr, PAGE_NUM(*ret))
+    ){
+        SET_FLAG(*ret, FLAG_TEXT);
+    }
+    return 0;
+}
+
+/*
+ * Resolve a fault at FAULTADDRESS, which lies in CURREGION of AS.
+ * Called with as_lock held.
+ */
+static int
+vm_fault_page(struct addrspace *as, region_ptr curRegion, int faulttype, vaddr_t faultaddress)
+{
+    page_table_entry *pte;
+    page_table_entry entry, newentry;
+    uint32_t entry_hi, entry_lo;
+    uint32_t asid;
+    unsigned refs;
+    bool populated;
+    int result = 0;
+    int tlb_index;
+
+    KASSERT(lock_do_i_hold(as->as_lock));
+
+    spinlock_acquire(&vm_spinlock);
+    pte = pagetable_lookup(as->pagetable, faultaddress);
+    spinlock_release(&vm_spinlock);
+    populated = pte != NULL;
+
+    /* only we add or remove our own PTEs, so it stays put */
+    if(!pte){
+        pte = pagetable_reserve(as->pagetable, faultaddress);
+        if(!pte){
             return ENOMEM;
         }
     }
 
-    if(!as->pagetable[l1_index][l2_index]){
-        region_ptr curr = as->region_start;
-        while(curr){
-            if(faultaddress >= curr->base &&
-                faultaddress < curr->base + curr->size
+    spinlock_acquire(&vm_spinlock);
+    for(;;){
+        pte_wait(pte);
+        entry = *pte;
+
+        if(faulttype == VM_FAULT_READONLY){
+            /* Only a write to a shared copy-on-write page is legal here */
+            if(!IS_FLAG_SET(curRegion->permission, FLAG_WRITE) || !entry){
+                result = EFAULT;
+                break;
+            }
+            /* Last sharer left: the frame is ours, just make it writable again */
+            if(IS_FLAG_SET(entry, TLBLO_VALID) &&
+                frame_getref(PAGE_NUM(entry)) == 1
             ){
-                if(IS_FLAG_SET(curr->permission, FLAG_WRITE)){
-                    dirty_bit = TLBLO_DIRTY;
+                SET_FLAG(*pte, TLBLO_DIRTY);
+                if(curRegion->mapped){
+                    SET_FLAG(*pte, FLAG_DIRTY);
                 }
                 break;
             }
-            curr = curr->next;
         }
-        if(!curr){
-            return EFAULT;
+        else if(IS_FLAG_SET(entry, TLBLO_VALID)){
+            break;
         }
-        if(pagetable_insert(as->pagetable,l1_index,l2_index,dirty_bit)){
-            return ENOMEM;
+
+        /* we need a frame; the busy bit holds the page while we sleep */
+        SET_FLAG(*pte, FLAG_BUSY);
+        spinlock_release(&vm_spinlock);
+        lock_release(as->as_lock);
+        result = vm_page_fill(as, curRegion, entry, faultaddress, &newentry);
+        lock_acquire(as->as_lock);
+        spinlock_acquire(&vm_spinlock);
+
+        /* nobody removes or changes a busy PTE; make sure it's still ours */
+        KASSERT(pagetable_lookup(as->pagetable, faultaddress) == pte);
+        KASSERT(IS_FLAG_SET(*pte, FLAG_BUSY));
+        KASSERT(as_find_region(as, faultaddress) == curRegion);
+        if(result == 0){
+            *pte = newentry | FLAG_BUSY;
+            if(IS_FLAG_SET(entry, TLBLO_VALID)){
+                /* copied: drop our share of the old frame */
+                upage_untrack(PAGE_NUM(entry), as->pagetable);
+                free_kpages(PADDR_TO_KVADDR(PAGE_NUM(entry)));
+            }
+        }
+        pte_unbusy(pte);
+        if(result){
+            break;
         }
+        /* go round again: a swapped-in page may still need its COW fault */
+    }
+    if(result){
+        spinlock_release(&vm_spinlock);
+        return result;
     }
 
-    entry_hi = PAGE_NUM(faultaddress);
-    entry_lo = as->pagetable[l1_index][l2_index];
+    /* an unshared page is a candidate for replacement; mark it referenced */
+    refs = frame_getref(PAGE_NUM(*pte));
+    if(refs == 1 || (refs == 2 && IS_FLAG_SET(*pte, FLAG_TEXT))){
+        upage_track(PAGE_NUM(*pte), as, faultaddress);
+    }
+    SET_FLAG(*pte, FLAG_USED);
 
-    spl = splhigh();
-    tlb_random(entry_hi, entry_lo);
-    splx(spl);
+    /* we may have slept and lost our id; as_asid hands out a new one */
+    asid = as_asid(as);
+    entry_hi = PAGE_NUM(faultaddress) | (asid << TLBHI_PIDSHIFT);
+    if(faulttype != VM_FAULT_READONLY){
+        curcpu->c_tlb.ct_misses++;
+        if(IS_FLAG_SET(*pte, FLAG_PREFETCHED)){
+            curcpu->c_tlb.ct_prefetch_wasted++;
+        }
+        /* neighbours first, so they can't push out the entry we need */
+        if(populated){
+            vm_faultaround(as->pagetable, faultaddress, asid);
+        }
+    }
+    CLEAR_FLAG(*pte, FLAG_PREFETCHED);
+    entry_lo = *pte;
+    as->stlb[VM_STLB_SLOT(faultaddress)].se_vaddr = faultaddress;
+    as->stlb[VM_STLB_SLOT(faultaddress)].se_pte = pte;
+
+    /* A readonly fault means the stale entry is still in the TLB */
+    tlb_index = tlb_probe(entry_hi, 0);
+    if(tlb_index >= 0){
+        tlb_write(entry_hi, entry_lo, tlb_index);
+    }
+    else{
+        tlb_random(entry_hi, entry_lo);
+    }
+    spinlock_release(&vm_spinlock);
     return 0;
 }
 
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+    struct addrspace *as;
+    region_ptr curRegion;
+    int result;
+
+    as = proc_getas();
+
+    if(!faultaddress | !as){
+        return EFAULT;
+    }    
+    
+    faultaddress = PAGE_NUM(faultaddress);
+    if(vm_stlb_enabled && faulttype != VM_FAULT_READONLY &&
+        vm_fault_fast(as, faultaddress)
+    ){
+        return 0;
+    }
+
+    lock_acquire(as->as_lock);
+    curRegion = as_find_region(as, faultaddress);
+    if(!curRegion) {
+        curRegion = as_grow_stack(as, faultaddress);
+    }
+    if(!curRegion) {
+        lock_release(as->as_lock);
+        return EFAULT;
+    }
+    result = vm_fault_page(as, curRegion, faulttype, faultaddress);
+    lock_release(as->as_lock);
+    return result;
+}
+
 /*
- * SMP-specific functions.  Unused in our UNSW configuration.
+ * SMP-specific functions.
+ *
+ * Page replacement may unmap a page belonging to a process running
+ * on another cpu, so it asks every cpu to drop the mapping and waits
+ * for each to acknowledge.
  */
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-    (void)ts;
-    panic("vm tried to do tlb shootdown?!\n");
+    as_tlb_invalidate(ts->ts_as, ts->ts_vaddr);
+    V(ts->ts_done);
 }
-